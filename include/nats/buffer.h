@@ -0,0 +1,151 @@
+#ifndef NATS_BUFFER_H
+#define NATS_BUFFER_H
+
+#include "core.h"
+
+#include <cstddef>
+#include <expected>
+#include <memory>
+#include <span>
+#include <string_view>
+
+namespace nats {
+
+/// @brief  A block of memory that bytes from the server are received into.
+class Slab {
+public:
+    explicit Slab(std::size_t capacity)
+        : bytes_(std::make_unique_for_overwrite<char[]>(capacity)), capacity_(capacity) {}
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    char* data() { return bytes_.get(); }
+    const char* data() const { return bytes_.get(); }
+    std::size_t capacity() const { return capacity_; }
+
+private:
+    std::unique_ptr<char[]> bytes_;
+    std::size_t capacity_;
+};
+
+/// @brief  Where bytes from the server are received and parsed in place
+///
+/// Bytes are written to the space returned by prepare(), appended with
+/// commit() and read from data() until they are consumed.
+class ReceiveBuffer {
+public:
+    virtual ~ReceiveBuffer() = default;
+
+    /// @brief  Space to receive into
+    /// @param size The minimum number of bytes needed.
+    /// @return Writable space of at least `size` bytes following data().
+    virtual std::span<char> prepare(std::size_t size) = 0;
+
+    /// @brief  Append `size` bytes written to the space returned by prepare().
+    virtual void commit(std::size_t size) = 0;
+
+    /// @brief  The received bytes that have not been consumed yet.
+    virtual std::string_view data() const = 0;
+
+    /// @brief  Discard `size` bytes from the front of data().
+    virtual void consume(std::size_t size) = 0;
+
+    /// @brief  A reference that keeps data() readable, empty when the bytes
+    /// are reused as soon as they are consumed.
+    virtual SlabRef slab() const = 0;
+
+    /// @brief  The memory every prepare() space lies in, empty when it moves
+    /// from one read to the next
+    ///
+    /// Stays put until a prepare() has to replace it, so it can be registered
+    /// with the kernel for fixed-buffer reads.
+    virtual std::span<char> region() const = 0;
+};
+
+/// @brief  Receive buffer made of refcounted slabs
+///
+/// Bytes are received at the end of the current slab and parsed in place.
+/// MessageViews hold a reference to the slab they point into, so a slab is
+/// only compacted and reused once no view refers to it any more; otherwise the
+/// unconsumed bytes move to a fresh slab and the old one is freed by the last
+/// view that releases it.
+class SlabBuffer : public ReceiveBuffer {
+public:
+    explicit SlabBuffer(std::size_t slabSize = 64 * 1024);
+    SlabBuffer(const SlabBuffer&) = delete;
+    SlabBuffer& operator=(const SlabBuffer&) = delete;
+
+    /// @brief  Space to receive into
+    ///
+    /// The slab grows when a single frame needs more than a slab.
+    std::span<char> prepare(std::size_t size) override;
+
+    void commit(std::size_t size) override;
+
+    std::string_view data() const override {
+        return {slab_->data() + begin_, end_ - begin_};
+    }
+
+    void consume(std::size_t size) override;
+
+    /// @brief  A reference to the slab that data() points into.
+    SlabRef slab() const override { return slab_; }
+
+    /// @brief  Empty: reads go to whichever slab is current.
+    std::span<char> region() const override { return {}; }
+
+private:
+    std::size_t slabSize_;
+    std::shared_ptr<Slab> slab_;
+    std::size_t begin_ = 0;
+    std::size_t end_ = 0;
+};
+
+/// @brief  Receive buffer on a ring mapped twice in a row
+///
+/// The same memory appears at [base, base + capacity) and again right after
+/// it, so the unconsumed bytes are contiguous even when they wrap around the
+/// end of the ring and nothing is ever compacted or copied. Consumed bytes
+/// are overwritten by later reads: views into the ring are only valid until
+/// the next read, and slab() is empty. The ring is only replaced by a larger
+/// one when a single frame needs more than its capacity.
+class RingBuffer : public ReceiveBuffer {
+public:
+    /// @brief  Map a ring of at least `capacity` bytes, rounded up to pages.
+    static std::expected<std::unique_ptr<RingBuffer>, Error> create(std::size_t capacity = 1024 * 1024);
+
+    ~RingBuffer() override;
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    std::span<char> prepare(std::size_t size) override;
+    void commit(std::size_t size) override;
+
+    std::string_view data() const override {
+        return {base_ + begin_, end_ - begin_};
+    }
+
+    void consume(std::size_t size) override;
+    SlabRef slab() const override { return nullptr; }
+
+    /// @brief  Both mappings of the ring.
+    std::span<char> region() const override { return {base_, 2 * capacity_}; }
+
+    std::size_t capacity() const { return capacity_; }
+
+private:
+    RingBuffer(char* base, std::size_t capacity) : base_(base), capacity_(capacity) {}
+
+    /// map `capacity` bytes twice, `capacity` being a multiple of the page size.
+    static std::expected<char*, Error> map(std::size_t capacity);
+
+    char* base_;
+    std::size_t capacity_;
+    /// offsets of data(); begin_ stays below capacity_ and end_ below begin_ + capacity_.
+    std::size_t begin_ = 0;
+    std::size_t end_ = 0;
+};
+
+} // namespace nats
+
+#endif // NATS_BUFFER_H
@@ -2,21 +2,35 @@
 #define NATS_CLIENT_H
 
 #include "logging.h"
+#include "buffer.h"
 #include "core.h"
+#include "headers.h"
+#include "inline_function.h"
+#include "subject_trie.h"
+#include "write_queue.h"
 
 #include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <expected>
 #include <functional>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
+#include <string_view>
 #include <tuple>
+#include <utility>
 #include <unordered_map>
+#include <variant>
 #include <vector>
 
 namespace net = boost::asio;
 using tcp = net::ip::tcp;
 using nats::Message;
 using nats::MessageResult;
+using nats::MessageView;
 using nats::Core;
 
 struct NATSError {
@@ -28,12 +42,109 @@ struct NATSInfo {
     std::string server_id;
     std::optional<std::string> nonce;
     std::vector<std::string> connect_urls;
+    /// the largest payload the server accepts and delivers.
+    std::size_t max_payload = 1024 * 1024;
     bool verbose = false;
 };
 
+struct NATSOptions {
+    enum class ReceiveBuffer {
+        /// refcounted slabs; MessageViews may be kept past their handler.
+        Slab,
+        /// a mirrored ring (Linux); MessageViews are only valid in their handler.
+        /// Slabs are used where the ring cannot be mapped.
+        Ring
+    };
+    ReceiveBuffer receiveBuffer = ReceiveBuffer::Slab;
+    /// the initial capacity of the ring.
+    std::size_t ringSize = 1024 * 1024;
+    /// @brief  Register the ring with io_uring and receive with fixed-buffer reads
+    ///
+    /// Needs a build with NATS_IO_URING and the Ring receive buffer; ignored
+    /// otherwise, and dropped when the kernel refuses the registration.
+    bool registerBuffers = false;
+
+    /// @brief  Send writes carrying a payload of zeroCopyMinSize or more with MSG_ZEROCOPY
+    ///
+    /// The kernel then reads the payload from the queued buffers instead of
+    /// copying it, and the buffers are kept until it reports them done. Smaller
+    /// writes are copied as usual. Ignored when the socket refuses SO_ZEROCOPY.
+    bool zeroCopy = false;
+    std::size_t zeroCopyMinSize = 16 * 1024;
+
+    /// @brief  High-water marks of the outbound queue, 0 for no limit
+    ///
+    /// The queue counts what has not been written yet, including the write in
+    /// flight. A message is always accepted into an empty queue.
+    std::size_t maxPendingBytes = 0;
+    std::size_t maxPendingMsgs = 0;
+    /// blocked and awaiting publishes resume below these, by default half the high-water marks.
+    std::size_t lowPendingBytes = 0;
+    std::size_t lowPendingMsgs = 0;
+
+    /// what pub() does above a high-water mark; asyncPub() always waits.
+    enum class OnFull {
+        /// return an error.
+        Fail,
+        /// run the io_context until the queue drains below the low-water
+        /// marks, or fail after blockTimeout. Fails inside the io_context and
+        /// while it is stopped.
+        Block
+    };
+    OnFull onFull = OnFull::Fail;
+    std::chrono::milliseconds blockTimeout{1000};
+
+    /// threads running the handlers of queued subscriptions, see
+    /// NATSSubOptions::pendingMsgs; started with the first one.
+    std::size_t workers = 1;
+};
+
+/// options of NATSClient::sub().
+struct NATSSubOptions {
+    std::optional<std::string> queueGroup;
+    /// @brief  Run the handler on the worker pool, 0 to run it on the IO thread
+    ///
+    /// The IO thread copies each message into a lock-free queue holding up
+    /// to this many messages, and a worker hands them to the handler in
+    /// order. The handler must not use the client directly, it runs on
+    /// another thread; it may still be running when unsubscribe returns.
+    /// Chunk handlers always run on the IO thread.
+    std::size_t pendingMsgs = 0;
+    /// payload and header bytes the queue may hold, 0 for no limit.
+    std::size_t pendingBytes = 0;
+
+    /// what happens to a message that finds the queue at a limit.
+    enum class OnSlowConsumer {
+        /// the message is dropped.
+        DropNewest,
+        /// the oldest messages are dropped by the worker before it delivers
+        /// the next one. Meanwhile the queue takes up to twice the limits,
+        /// beyond that the newest are dropped.
+        DropOldest,
+        /// the message is dropped and the connection closed.
+        Disconnect
+    };
+    OnSlowConsumer onSlowConsumer = OnSlowConsumer::DropNewest;
+
+    /// @brief  End the subscription after this many messages, 0 for never
+    ///
+    /// Sent as `UNSUB <sid> <max>` right behind the SUB, so the server stops
+    /// on its own; the handler slot is freed as the last message arrives.
+    std::uint64_t autoUnsubscribe = 0;
+
+    /// @brief  Split the queue into this many partitions by a hash of the subject
+    ///
+    /// Each partition has its own queue and keeps its messages in order, so
+    /// messages on one subject are handled in the order they arrived while
+    /// the partitions are drained by the workers in parallel. The handler
+    /// is then called from several workers at once. The limits above are
+    /// shared out evenly between the partitions.
+    std::size_t partitions = 1;
+};
+
 class NATSClient {
 public:
-    NATSClient(net::io_context& io_context, const std::string& host, const std::string& port);
+    NATSClient(net::io_context& io_context, const std::string& host, const std::string& port, const NATSOptions& options = {});
     NATSClient(const NATSClient&) = delete;
     NATSClient& operator=(const NATSClient&) = delete;
     void start();
@@ -42,22 +153,335 @@ public:
 
     ///
     /// \begingroup NATS core public client API
-    void pub( const Message& msg);
-    void hpub(const std::string& subject);
+    /// fails when the outbound queue is full, see NATSOptions::onFull, or once
+    /// the connection has closed.
+    typedef std::expected<void, NATSError> PubResult;
+    /// publishes with HPUB when msg.headers is not empty.
+    PubResult pub( const Message& msg);
+    /// takes over the payload; large payloads are written without copying.
+    PubResult pub(Message&& msg);
+    /// the payload is written from the shared buffer without copying and
+    /// released once written.
+    PubResult pub(const std::string& subject, const nats::SharedPayload& payload, const std::optional<std::string>& replyTo = std::nullopt);
+    /// @brief  Publish a payload the client takes over
+    ///
+    /// The payload belongs to the outbound queue from the call on; large
+    /// payloads are written from it without a copy and freed once written.
+    /// Nothing is taken when the publish fails.
+    PubResult pub(std::string_view subject, std::string&& payload, const std::optional<std::string>& replyTo = std::nullopt);
+    /// @brief  Publish bytes the caller keeps
+    ///
+    /// The bytes are copied before the call returns, so the caller may reuse
+    /// the buffer right away.
+    PubResult pub(std::string_view subject, std::span<const std::byte> payload, const std::optional<std::string>& replyTo = std::nullopt);
+    /// @brief  Publish messages together
+    ///
+    /// All of them are copied into the outbound queue in one go and go out
+    /// with the same write, in order. They are admitted as a whole against the
+    /// high-water marks: either every message is queued or none is.
+    PubResult pubMany(std::span<const Message> msgs);
+    PubResult hpub(const Message& msg, const nats::HeaderBuilder& headers);
+
+    /// @brief  Publish once the outbound queue has room
+    ///
+    /// Queues the message right away when the queue is below its high-water
+    /// marks; otherwise waits until writes drain it below the low-water marks.
+    /// Waiting messages are queued in order, ahead of later publishes. Completes
+    /// with net::error::not_connected when the connection closes first or has
+    /// already closed. Takes the same tokens as flush().
+    template <typename CompletionToken>
+    auto asyncPub(Message msg, CompletionToken&& token) {
+        return net::async_initiate<CompletionToken, void(boost::system::error_code)>(
+            [this](auto handler, Message msg) {
+                auto done = std::make_unique<CompletionOf<decltype(handler)>>(std::move(handler), io_context_.get_executor());
+                if (closed_) {
+                    done->complete(net::error::not_connected);
+                    return;
+                }
+                if (full(frameSize(msg))) {
+                    blockedPubs_.push_back(BlockedPub{std::move(msg), std::move(done)});
+                    return;
+                }
+                enqueue(std::move(msg));
+                done->complete({});
+            }, token, std::move(msg));
+    }
+
+    /// what the outbound queue holds, including the write in flight.
+    struct Pending {
+        std::size_t bytes = 0;
+        std::size_t msgs = 0;
+    };
+    Pending pending() const { return {writes_.pendingBytes(), queuedMsgs_ + inflightMsgs_}; }
+
+    /// @brief  Publishes to one subject and reply subject
+    ///
+    /// The subject is validated and the `PUB <subject> [reply-to] ` prefix is
+    /// rendered once, so each publish only adds the payload size and the
+    /// payload. A Publisher must not outlive its client.
+    class Publisher {
+    public:
+        /// the payload is copied.
+        PubResult pub(std::string_view payload);
+        /// the payload is written from the shared buffer without copying.
+        PubResult pub(const nats::SharedPayload& payload);
+
+    private:
+        friend class NATSClient;
+        Publisher(NATSClient& client, std::string prefix) : client_(&client), prefix_(std::move(prefix)) {}
 
-    struct Subscription {
-        std::string subject;
-        std::string sid;
-        std::optional<std::string> queueGroup;
+        /// queue the prefix and the size of a payload.
+        void writeControl(std::size_t size);
+
+        NATSClient* client_;
+        std::string prefix_;
+    };
+
+    /// @brief  Holds back writes while it exists, see batch().
+    class Batch {
+    public:
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+        Batch(Batch&& other) noexcept : client_(std::exchange(other.client_, nullptr)) {}
+        Batch& operator=(Batch&&) = delete;
+        ~Batch() {
+            if (client_) {
+                client_->uncork();
+            }
+        }
+
+    private:
+        friend class NATSClient;
+        explicit Batch(NATSClient& client) : client_(&client) {}
+
+        NATSClient* client_;
     };
-    typedef std::function<Message(const Message&)> MessageHandler;
-    void sub(const Subscription& subscription, const MessageHandler& handler);
-    void unsub(const std::string& sid);
+
+    /// @brief  Publish a burst of messages as one write
+    ///
+    /// Frames queued while the returned scope exists are not written until it
+    /// ends, when they go out together with a single gather write. Scopes may nest.
+    [[nodiscard]] Batch batch();
+
+    /// @brief  Hold back writes until the matching uncork(); calls nest.
+    void cork();
+    /// @brief  End a cork() and write what was queued once no cork is left.
+    void uncork();
+
+    /// @brief  Wait until the server has processed everything sent so far
+    ///
+    /// Queues a PING and completes when its PONG arrives; the server answers
+    /// PINGs in order, so every frame queued before has been processed by then.
+    /// Outstanding flushes complete in the order they were started, with
+    /// net::error::not_connected when the connection is closed first; a flush
+    /// started after it has closed completes with that error right away. The
+    /// token may be a callback taking a boost::system::error_code,
+    /// net::use_future or net::use_awaitable; callbacks run on their
+    /// associated executor, by default the client's.
+    template <typename CompletionToken>
+    auto flush(CompletionToken&& token) {
+        return net::async_initiate<CompletionToken, void(boost::system::error_code)>(
+            [this](auto handler) {
+                auto done = std::make_unique<CompletionOf<decltype(handler)>>(std::move(handler), io_context_.get_executor());
+                if (closed_) {
+                    done->complete(net::error::not_connected);
+                    return;
+                }
+                flushes_.push_back(std::move(done));
+                ping();
+            }, token);
+    }
+
+    struct Stats {
+        /// gather writes started, each one a single async_write.
+        std::uint64_t writes = 0;
+        std::uint64_t bytesWritten = 0;
+        /// sends with MSG_ZEROCOPY, those the kernel reported done, and those
+        /// it copied anyway (always the case over loopback).
+        std::uint64_t zeroCopySends = 0;
+        std::uint64_t zeroCopyDone = 0;
+        std::uint64_t zeroCopyCopied = 0;
+    };
+    const Stats& stats() const { return stats_; }
+
+    /// @brief  A Publisher for a subject, or an error when it is not a valid publish subject.
+    std::expected<Publisher, NATSError> publisher(const std::string& subject, const std::optional<std::string>& replyTo = std::nullopt);
+
+    /// @brief  Subscription id, allocated by the client
+    ///
+    /// The low 32 bits are the handler slot plus one and the high 32 bits the
+    /// generation of the slot, so a sid is not reused while messages sent to
+    /// an earlier holder of the slot may still arrive.
+    typedef std::uint64_t Sid;
+
+    /// @brief  Unsubscribes when it goes out of scope
+    ///
+    /// Returned by sub(); moving it hands the subscription over. A
+    /// Subscription must not outlive its client.
+    class [[nodiscard]] Subscription {
+    public:
+        Subscription() = default;
+        Subscription(const Subscription&) = delete;
+        Subscription& operator=(const Subscription&) = delete;
+        Subscription(Subscription&& other) noexcept
+            : client_(std::exchange(other.client_, nullptr)), sid_(std::exchange(other.sid_, 0)) {}
+        Subscription& operator=(Subscription&& other) noexcept {
+            if (this != &other) {
+                unsubscribe();
+                client_ = std::exchange(other.client_, nullptr);
+                sid_ = std::exchange(other.sid_, 0);
+            }
+            return *this;
+        }
+        ~Subscription() { unsubscribe(); }
+
+        Sid sid() const { return sid_; }
+        explicit operator bool() const { return client_ != nullptr; }
+        /// @brief  Messages waiting for a queued handler, see NATSClient::pending(Sid).
+        Pending pending() const { return client_ ? client_->pending(sid_) : Pending{}; }
+        /// @brief  Messages the queue dropped, see NATSClient::dropped(Sid).
+        std::uint64_t dropped() const { return client_ ? client_->dropped(sid_) : 0; }
+        /// @brief  Unsubscribe now instead of on destruction.
+        void unsubscribe();
+        /// @brief  Unsubscribe once `max` messages in all have arrived, see NATSClient::unsub(Sid, std::uint64_t).
+        void unsubscribe(std::uint64_t max) {
+            if (client_) {
+                client_->unsub(sid_, max);
+            }
+        }
+        /// @brief  Keep the subscription after the handle is gone
+        /// @return The sid to end it with NATSClient::unsub().
+        Sid release();
+
+    private:
+        friend class NATSClient;
+        Subscription(NATSClient& client, Sid sid) : client_(&client), sid_(sid) {}
+
+        NATSClient* client_ = nullptr;
+        Sid sid_ = 0;
+    };
+    /// receives messages copied out of the receive buffer. Handlers are
+    /// move-only and kept inline when small, see nats::InlineFunction.
+    typedef nats::InlineFunction<void(const Message&)> MessageHandler;
+    /// receives messages without copying them out of the receive buffer.
+    typedef nats::InlineFunction<void(const MessageView&)> MessageViewHandler;
+    /// receives the payload in pieces as it arrives, see nats::Core::stream().
+    typedef nats::InlineFunction<void(const nats::MessageChunk&)> MessageChunkHandler;
+    /// answers a request with the message it returns, see reply().
+    typedef std::function<Message(const Message&)> ReplyHandler;
+    Subscription sub(std::string_view subject, MessageHandler handler, const NATSSubOptions& options = {});
+    Subscription sub(std::string_view subject, MessageViewHandler handler, const NATSSubOptions& options = {});
+    /// @brief  Subscribe with a handler that gets payloads in chunks
+    ///
+    /// A message that arrives whole is delivered as a single chunk; a larger one
+    /// is delivered while it is received, so the client only ever buffers one
+    /// read of it instead of the whole payload.
+    Subscription sub(std::string_view subject, MessageChunkHandler handler, const NATSSubOptions& options = {});
+
+    /// @brief  Subscribe and hand the messages to the local routes
+    ///
+    /// Each message goes to every route whose pattern matches its subject, so
+    /// thousands of local handlers, wildcards included, can share one server
+    /// subscription. The routes apply to all routed subscriptions.
+    Subscription subRouted(std::string_view subject, const std::optional<std::string>& queueGroup = std::nullopt);
+    typedef nats::SubjectTrie::Id RouteId;
+    /// @brief  Route subjects matching `pattern`, which may use `*` and `>`, to a handler
+    /// @return The id to remove the route with, or an error for an invalid pattern.
+    std::expected<RouteId, NATSError> route(std::string_view pattern, MessageViewHandler handler);
+    /// @brief  Remove a route, also from inside a route handler.
+    void unroute(RouteId id);
+    /// @brief  Send UNSUB and release the handler, also from inside it
+    ///
+    /// Messages for the sid that arrive afterwards are dropped.
+    void unsub(Sid sid);
+    /// @brief  Have the server end a subscription once `max` messages in all have been sent
+    ///
+    /// Counts the messages already received, so a subscription that has had
+    /// `max` ends now.
+    void unsub(Sid sid, std::uint64_t max);
+    /// @brief  What the queue of a queued subscription holds, empty for others.
+    Pending pending(Sid sid) const;
+    /// @brief  Messages a queued subscription dropped at its limits, 0 for others.
+    std::uint64_t dropped(Sid sid) const;
+
+    /// @brief  Called with the sid of a queued subscription that reaches its limits
+    ///
+    /// Runs on the client's executor once each time a queue fills up, not for
+    /// every message dropped while it stays full.
+    typedef std::function<void(Sid sid, const NATSError& error)> ErrorHandler;
+    void setErrorHandler(const ErrorHandler& handler) { errorHandler_ = handler; }
+
+    /// @brief  A new reply subject, `_INBOX.<prefix>.<n>`
+    ///
+    /// The prefix is random and drawn once per client, so inboxes are not
+    /// shared with other clients of the server, in this process or another.
+    std::string newInbox();
     /// \endgroup
     
 private:
-    void send(const std::string& message);
+    /// the handler of a routed subscription.
+    struct Routed {};
+    /// the queues and handler of a subscription delivered on the worker pool.
+    struct Queued;
+    typedef std::variant<MessageViewHandler, MessageChunkHandler, Routed, std::shared_ptr<Queued>> Handler;
+    /// queue a frame; it is written with everything queued behind it.
+    void send(std::string message);
+    /// start writing what is queued unless a write is in flight.
+    void writeQueued();
+    void doWrite();
+    /// release the buffers of zero-copy sends the kernel is done with, and
+    /// wait for more notifications while any are outstanding.
+    void reapZeroCopy();
+    void readZeroCopyNotifications();
+    /// queue a PUB or HPUB control line.
+    void writeControl(std::string_view op, std::string_view subject, const std::optional<std::string>& replyTo,
+        std::optional<std::size_t> headerSize, std::size_t totalSize);
     void close();
+    /// register a handler under a new sid and send SUB for it.
+    Subscription subscribe(std::string_view subject, const std::optional<std::string>& queueGroup, Handler handler,
+        std::uint64_t max = 0);
+    /// the active slot of a sid, no_slot for none.
+    std::size_t findSlot(Sid sid) const;
+    std::size_t findSlot(std::string_view sid) const;
+    void releaseSlot(std::size_t index);
+    /// stop matching a slot's sid and release it, once its handler returns if it is running.
+    void endSlot(std::size_t index);
+    /// count a message for a slot about to deliver it, ending the slot at its max.
+    void countMessage(std::size_t index);
+    /// a queue for a handler taking the copied messages, starting the workers.
+    std::shared_ptr<Queued> makeQueued(const NATSSubOptions& options, nats::InlineFunction<void(Message&&)> handler);
+    /// copy a message into a queue and have a worker drain it unless one is already.
+    void enqueue(const std::shared_ptr<Queued>& queued, Sid sid, const MessageView& msg);
+    /// hand the messages of a lane to the handler on a worker.
+    static void drain(const std::shared_ptr<Queued>& queued, std::size_t lane, net::thread_pool& pool);
+    /// run a handler of a slot; it may unsubscribe itself meanwhile.
+    template <typename Deliver>
+    void deliver(std::size_t index, Deliver&& deliver) {
+        delivering_ = index;
+        deliver();
+        delivering_ = no_slot;
+        if (std::exchange(releaseDelivering_, false)) {
+            releaseSlot(index);
+        }
+    }
+    /// deliver a message of a routed subscription to the matching routes.
+    void dispatchRoutes(const MessageView& msg);
+    /// queue an HPUB frame without starting a write.
+    void hpub(const Message& msg, std::string_view headers);
+    /// queue a PUB or HPUB frame without starting a write.
+    void encode(const Message& msg);
+    /// queue a message and write it, without checking the high-water marks.
+    void enqueue(const Message& msg);
+    void enqueue(Message&& msg);
+    /// wait for room for `msgs` messages of `bytes` in all, according to NATSOptions::onFull.
+    PubResult admit(std::size_t bytes, std::size_t msgs = 1);
+    /// true when the frames have to wait for room.
+    bool full(std::size_t bytes, std::size_t msgs = 1) const;
+    bool aboveHighWater(std::size_t bytes, std::size_t msgs = 1) const;
+    bool belowLowWater() const;
+    /// queue blocked asyncPub() messages once the queue is below the low-water marks.
+    void releaseBlocked();
+    static std::size_t frameSize(const Message& msg);
 
     ///
     /// \begingroup NATS private client API
@@ -71,40 +495,162 @@ private:
 
     ///
     /// \begingroup handlers for NATS server APIs
-    void handleErr();
+    void handleErr(const nats::Err& err);
     void handleOk();
-    void handleInfo();
-    void handleMsg();
+    void handleInfo(const nats::Info& info);
     void handlePing();
-    /// @brief
-    /// @param is 
-    /// @return next operation to perform
-    Message handleMsgPayload(const Message& msg);
+    void handlePong();
+    /// @brief  deliver a message to the handler of its subscription
+    void handleMsgPayload(const MessageView& msg);
+    void handleMsgChunk(const nats::MessageChunk& chunk);
     /// \endgroup
 
+    /// an asynchronous operation waiting to complete; the handler type is erased.
+    struct Completion {
+        virtual ~Completion() = default;
+        virtual void complete(const boost::system::error_code& ec) = 0;
+    };
+
+    template <typename Handler>
+    struct CompletionOf : Completion {
+        CompletionOf(Handler&& handler, const net::io_context::executor_type& executor)
+            : handler(std::move(handler)), executor(net::get_associated_executor(this->handler, executor)) {}
+
+        void complete(const boost::system::error_code& ec) override {
+            // never run the handler inside the read loop.
+            net::post(executor, [handler = std::move(handler), ec]() mutable {
+                std::move(handler)(ec);
+            });
+        }
+
+        Handler handler;
+        net::associated_executor_t<Handler, net::io_context::executor_type> executor;
+    };
+
+    /// complete every outstanding flush and blocked publish with an error.
+    void failPending(const boost::system::error_code& ec);
+
+    struct BlockedPub {
+        Message msg;
+        std::unique_ptr<Completion> done;
+    };
+
     // async handlers
     void onConnect(const boost::system::error_code& ec);
     void onWrite(const boost::system::error_code& ec, std::size_t bytes_transferred);
+
+    /// @brief  The socket as a stream whose writes are sends with MSG_ZEROCOPY
+    ///
+    /// Counts the successful sends, which the kernel numbers the same way.
+    struct ZeroCopySocket {
+        typedef tcp::socket::executor_type executor_type;
+        executor_type get_executor() { return socket.get_executor(); }
+
+        template <typename ConstBufferSequence, typename WriteHandler>
+        void async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler);
+
+        tcp::socket& socket;
+        std::uint64_t sends = 0;
+    };
     void doRead();
+#if defined(BOOST_ASIO_HAS_IO_URING)
+    /// `space` in the registered receive buffer, registering it first if the buffer moved.
+    std::optional<net::mutable_registered_buffer> registeredBuffer(std::span<char> space);
+#endif
+    /// switch a partially received message of a chunked subscription to streaming.
+    void streamPartial();
     void onRead(const boost::system::error_code& ec, std::size_t bytes_transferred);
 
-    std::expected<NATSInfo, NATSError> parseInfo(std::istream& is);
+    std::expected<NATSInfo, NATSError> parseInfo(std::string_view json);
 
     net::io_context& io_context_;
     tcp::resolver resolver_;
     tcp::socket socket_;
     std::string host_;
     std::string port_;
-    boost::asio::streambuf response_;
+    /// reads ask the socket for at least this many bytes.
+    static constexpr std::size_t read_size = 4096;
+    nats::WriteQueue writes_;
+    /// flushes whose PONG has not arrived, oldest first.
+    std::deque<std::unique_ptr<Completion>> flushes_;
+    /// asyncPub() messages waiting for room, oldest first.
+    std::deque<BlockedPub> blockedPubs_;
+    NATSOptions options_;
+    /// messages queued and in the write in flight.
+    std::size_t queuedMsgs_ = 0;
+    std::size_t inflightMsgs_ = 0;
+    /// number of cork() calls without a matching uncork().
+    std::size_t corks_ = 0;
+    /// set once the socket is closed; nothing is queued for writing after that.
+    bool closed_ = false;
+    Stats stats_;
+    /// set once SO_ZEROCOPY is enabled on the socket.
+    bool zeroCopy_ = false;
+    /// the write in flight is sent with MSG_ZEROCOPY.
+    bool zeroCopyWrite_ = false;
+    /// waiting for the error queue.
+    bool zeroCopyWaiting_ = false;
+    ZeroCopySocket zeroCopySocket_{socket_};
+    std::unique_ptr<nats::ReceiveBuffer> buffer_;
+#if defined(BOOST_ASIO_HAS_IO_URING)
+    std::optional<net::buffer_registration<net::mutable_buffer>> registration_;
+    /// the buffer region registration_ covers.
+    std::span<char> registered_;
+#endif
+    /// bytes still missing from a partially received message.
+    std::size_t bytesNeeded_ = 0;
     Core core_;
+    /// operations parsed from the last read, reused between reads.
+    std::vector<nats::Op> ops_;
     Logger log_;
 
-    /// the subscription key is a tuple of the subject and the sid.
-    /// maps subscribed sid tuples to message handlers.
-    std::unordered_map<std::string, MessageHandler> handlers_;
+    struct Slot {
+        std::uint32_t generation = 0;
+        bool active = false;
+        Handler handler;
+        /// messages received, and those after which the server ends it, 0 for no limit.
+        std::uint64_t received = 0;
+        std::uint64_t max = 0;
+    };
+    /// handlers indexed by the slot of their sid; a deque so that subscribing
+    /// from inside a handler does not move the one running.
+    std::deque<Slot> slots_;
+    std::vector<std::uint32_t> freeSlots_;
+    static constexpr std::size_t no_slot = static_cast<std::size_t>(-1);
+    /// the slot whose handler is running, and whether it was unsubscribed meanwhile.
+    std::size_t delivering_ = no_slot;
+    bool releaseDelivering_ = false;
+
+    struct Route {
+        std::string pattern;
+        MessageViewHandler handler;
+    };
+    nats::SubjectTrie routes_;
+    std::unordered_map<RouteId, Route> routeHandlers_;
+    RouteId nextRoute_ = 0;
+    /// the routes matched by the message being dispatched, and those removed meanwhile.
+    std::vector<RouteId> matched_;
+    std::vector<RouteId> unrouted_;
+    bool dispatching_ = false;
+
+    ErrorHandler errorHandler_;
+    /// `_INBOX.<random>.` and the number of inboxes made with it.
+    const std::string inboxPrefix_;
+    std::uint64_t inboxes_ = 0;
+    /// set by a slow consumer with OnSlowConsumer::Disconnect.
+    bool disconnect_ = false;
+
+    /// last, so that the workers are joined before anything they use goes away.
+    std::unique_ptr<net::thread_pool> workers_;
 };
 
-void request(NATSClient& nats_client, const Message& msg, const NATSClient::MessageHandler& handler);
-void reply(NATSClient& nats_client, const std::string& subject, const NATSClient::MessageHandler& handler);
+/// @brief  Publish a request with a new inbox to reply to
+///
+/// The handler gets the reply, after which the server ends the inbox. When
+/// the request cannot be published the inbox is unsubscribed right away
+/// and the error returned.
+NATSClient::PubResult request(NATSClient& nats_client, const Message& msg, NATSClient::MessageHandler handler);
+/// @brief  Answer requests on a subject until the returned subscription ends.
+NATSClient::Subscription reply(NATSClient& nats_client, const std::string& subject, const NATSClient::ReplyHandler& handler);
 
 #endif // NATS_CLIENT_H
@@ -1,13 +1,18 @@
 #ifndef NATS_CORE_H
 #define NATS_CORE_H
 
+#include <array>
 #include <cstddef>
+#include <cstdint>
 #include <expected>
+#include <memory>
 #include <optional>
 #include <ostream>
 #include <streambuf>
 #include <string>
+#include <string_view>
 #include <variant>
+#include <vector>
 
 namespace nats {
 
@@ -17,6 +22,8 @@ struct Message {
     std::optional<std::string> replyTo;
     std::size_t bytes = 0;
     std::string payload;
+    /// encoded header block (see HeaderView and HeaderBuilder), empty when there are no headers.
+    std::string headers;
 };
 
 inline bool operator!=(const Message& lhs, const Message& rhs) {
@@ -24,13 +31,48 @@ inline bool operator!=(const Message& lhs, const Message& rhs) {
         lhs.subject != rhs.subject ||
         lhs.sid != rhs.sid ||
         lhs.payload != rhs.payload ||
-        lhs.replyTo != rhs.replyTo;
+        lhs.replyTo != rhs.replyTo ||
+        lhs.headers != rhs.headers;
 }
 
 inline bool operator==(const Message& lhs, const Message& rhs) {
     return !(lhs != rhs);
 }
 
+class Slab;
+typedef std::shared_ptr<const Slab> SlabRef;
+
+/// @brief  A message that refers to the bytes received from the server
+///
+/// The views point into a receive buffer slab and stay valid as long as the
+/// slab is referenced. Delivering a MessageView does not allocate; a handler
+/// that needs the message after it returns can keep a copy of the view, which
+/// keeps the slab alive, or promote it to an owning Message.
+struct MessageView {
+    std::string_view subject;
+    std::string_view sid;
+    std::optional<std::string_view> replyTo;
+    /// the raw header block of an HMSG ("NATS/1.0..." up to the empty line), empty for MSG.
+    std::string_view headers;
+    std::string_view payload;
+    SlabRef slab;
+
+    /// copy the message out of the receive buffer.
+    Message toMessage() const {
+        Message msg{
+            .subject = std::string(subject),
+            .sid = std::string(sid),
+            .bytes = payload.size(),
+            .payload = std::string(payload),
+            .headers = std::string(headers)
+        };
+        if (replyTo.has_value()) {
+            msg.replyTo.emplace(*replyTo);
+        }
+        return msg;
+    }
+};
+
 /// @brief  more data is needed to finish parsing
 ///
 /// 'bytes' is present when the exact number of additional bytes is known.
@@ -50,6 +92,7 @@ inline bool operator==(const MessageNeedsMoreData& lhs, const MessageNeedsMoreDa
 }
 
 typedef std::variant<Message, MessageNeedsMoreData> OkMessage;
+typedef std::variant<MessageView, MessageNeedsMoreData> OkMessageView;
 
 struct Error {
     std::string what;
@@ -64,6 +107,53 @@ inline bool operator==(const Error& lhs, const Error& rhs) {
 }
 
 typedef std::expected<OkMessage, Error> MessageResult;
+typedef std::expected<OkMessageView, Error> MessageViewResult;
+
+/// INFO {"option_name":option_value,...}
+struct Info {
+    std::string_view json;
+};
+
+/// +OK
+struct Ok {};
+
+/// -ERR <error message>
+struct Err {
+    /// the message without the surrounding quotes.
+    std::string_view message;
+};
+
+/// PING
+struct Ping {};
+
+/// PONG
+struct Pong {};
+
+/// @brief  A piece of the payload of a message that is delivered in chunks
+///
+/// See Core::stream(). The subject, sid, reply subject and headers point into
+/// the parser and are the same for every chunk of a message; data points into
+/// the receive buffer.
+struct MessageChunk {
+    std::string_view subject;
+    std::string_view sid;
+    std::optional<std::string_view> replyTo;
+    std::string_view headers;
+    /// the bytes of the payload received in this chunk.
+    std::string_view data;
+    /// the position of data in the payload.
+    std::size_t offset = 0;
+    /// the size of the whole payload.
+    std::size_t size = 0;
+
+    bool last() const { return offset + data.size() == size; }
+};
+
+/// @brief  An operation sent by the server
+///
+/// MSG and HMSG are both delivered as a MessageView, or as MessageChunks once
+/// a message is streamed. String views point into the receive buffer.
+typedef std::variant<MessageView, Info, Ok, Err, Ping, Pong, MessageChunk> Op;
 
 class Core {
 public:
@@ -75,20 +165,197 @@ public:
     /// @brief  Procees message from the NATS server
     ///
     /// This function can read a partial message and signal to the caller that
-    /// more bytes are required. The caller should inspect the second element of
-    /// the tuple to determine if the message is complete. A value of 0 indicates
-    /// that the message is complete.
-    ///
-    /// The entire message header is expected to be in the buffer, else an error is
-    /// returned.
+    /// more bytes are required by returning MessageNeedsMoreData. Nothing is
+    /// consumed from the buffer until the whole message (header, payload and
+    /// trailing \r\n) is available, so the caller should append the next bytes
+    /// received from the server and call this function again.
     ///
     /// @param is This buffer contains the bytes received from the server.
-    /// @return A tuple containing the message and the number of bytes required to complete the message.
+    /// @return The complete message, a request for more data or an error.
     MessageResult handleMsg(std::streambuf& is);
-    //std::expected<Message, std::size_t> completeMsg(std::streambuf& is, const Message& msg);
+
+    /// @brief  Process message from a contiguous receive buffer
+    ///
+    /// The bytes are scanned in place and the control line is never copied.
+    /// When the message is incomplete, `consumed` is 0 and the parser remembers
+    /// how far it got; the next call must pass the same bytes followed by the
+    /// newly received ones and scanning resumes where it stopped, both in the
+    /// header and in the payload.
+    ///
+    /// @param data The unconsumed bytes received from the server.
+    /// @param consumed Set to the number of bytes of data used by the returned message.
+    /// @return The complete message, a request for more data or an error.
+    MessageResult handleMsg(std::string_view data, std::size_t& consumed);
+
+    /// @brief  Process message without copying it out of the receive buffer
+    ///
+    /// Works like handleMsg() but the returned view points into `data` and
+    /// nothing is allocated. The caller sets MessageView::slab when the bytes
+    /// live in a slab. MessageNeedsMoreData::partial is left empty.
+    MessageViewResult handleMsgView(std::string_view data, std::size_t& consumed);
+
+    /// @brief  Process every complete message in a receive buffer
+    ///
+    /// Parses MSG and HMSG operations from the front of `data` until the data
+    /// ends, a message is incomplete or a different operation starts, so a
+    /// whole read is handled in one call. `msgs` is cleared first and its capacity is
+    /// reused, so a steady stream of messages does not allocate.
+    ///
+    /// @param data The unconsumed bytes received from the server.
+    /// @param msgs Receives a view of every complete message.
+    /// @return The number of bytes used by the messages, or an error.
+    std::expected<std::size_t, Error> handleMsgs(std::string_view data, std::vector<MessageView>& msgs);
+
+    /// @brief  Process every complete operation in a receive buffer
+    ///
+    /// Recognizes all server operations (INFO, +OK, -ERR, PING, PONG, MSG and
+    /// HMSG) and parses them from the front of `data` until the data ends or
+    /// an operation is incomplete. `ops` is cleared first and its capacity is
+    /// reused.
+    ///
+    /// @param data The unconsumed bytes received from the server.
+    /// @param ops Receives every complete operation, on an error those before it.
+    /// @return The number of bytes used by the operations, or an error.
+    std::expected<std::size_t, Error> handleOps(std::string_view data, std::vector<Op>& ops);
+
+    /// @brief  The message whose payload is being received
+    ///
+    /// When handleOps() stopped at a message whose control line is complete
+    /// but whose payload is not, returns a view of it; the headers and the
+    /// payload hold the bytes received so far.
+    ///
+    /// @param data The unconsumed bytes, starting at the message.
+    std::optional<MessageView> partial(std::string_view data) const;
+
+    /// @brief  Deliver the rest of the partial message in chunks
+    ///
+    /// Copies the subject, sid, reply subject and headers of the message
+    /// returned by partial() and appends the payload bytes received so far
+    /// to `ops` as the first MessageChunk, even when there are none. From then
+    /// on handleOps() consumes payload bytes as soon as they arrive and turns
+    /// them into MessageChunks, so the receive buffer never holds more than
+    /// one read of the payload. Nothing happens until the header block of an
+    /// HMSG is complete.
+    ///
+    /// @param data The unconsumed bytes, starting at the message.
+    /// @param ops Receives the first chunk.
+    /// @return The number of bytes of data used, 0 when streaming did not start.
+    std::size_t stream(std::string_view data, std::vector<Op>& ops);
+
+    /// @brief  Bytes still missing from the partially received message, when known.
+    std::optional<std::size_t> bytesNeeded() const { return bytesNeeded_; }
+
+    /// @brief  Forget any partially parsed operation.
+    void reset();
+
+    /// @brief  Reject messages whose headers and payload exceed `bytes` together, 0 for no limit
+    ///
+    /// Checked when the control line is parsed, so neither buffered nor
+    /// streamed messages receive any of the payload of such a message.
+    void setMaxPayload(std::size_t bytes) { maxPayload_ = bytes; }
 
 private:
-    Message completeMsg(std::streambuf& is, Message&& msg);
+    /// the longest control line accepted (matches the server's max_control_line default).
+    static constexpr std::size_t max_control_line = 4096;
+
+    /// INFO lines carry the server's cluster urls and may be much longer.
+    static constexpr std::size_t max_info_line = 64 * 1024;
+
+    /// HMSG <subject> <sid> [reply-to] <#header bytes> <#total bytes>
+    static constexpr std::size_t max_args = 5;
+
+    enum class State {
+        OpStart,
+        OpHmsg,
+        ControlLine,
+        ControlLineLf,
+        Payload,
+        /// the payload of a streamed message and its trailing ␍␊.
+        Chunk,
+        ChunkEnd
+    };
+
+    /// the operation being parsed
+    enum class Kind {
+        Msg,
+        Hmsg,
+        Info,
+        Ok,
+        Err,
+        Ping,
+        Pong
+    };
+
+    /// location of a control line argument, relative to the start of the message.
+    struct Token {
+        std::size_t begin = 0;
+        std::size_t end = 0;
+    };
+
+    /// result of running the state machine over the available bytes.
+    enum class Scan {
+        Complete,
+        NeedsMoreData,
+        Failed
+    };
+
+    /// @brief  Operation names are matched four bytes at a time.
+    ///
+    /// Letters are folded to lower case so that operations are case insensitive
+    /// like in the server; other bytes are left alone.
+    static constexpr std::uint32_t fold(std::uint32_t word) {
+        return word | ((word >> 1) & 0x20202020);
+    }
+
+    static constexpr std::uint32_t prefix(const char (&op)[5]) {
+        return fold(static_cast<std::uint8_t>(op[0])
+            | static_cast<std::uint32_t>(static_cast<std::uint8_t>(op[1])) << 8
+            | static_cast<std::uint32_t>(static_cast<std::uint8_t>(op[2])) << 16
+            | static_cast<std::uint32_t>(static_cast<std::uint8_t>(op[3])) << 24);
+    }
+
+    bool isMsg() const { return kind_ == Kind::Msg || kind_ == Kind::Hmsg; }
+
+    Scan scan(std::string_view data);
+    Scan startOp(std::string_view data);
+    Scan fail(std::string what);
+    bool tokenize(std::string_view data, std::size_t begin, std::size_t end);
+    std::expected<void, Error> parseArgs(std::string_view data);
+    std::string_view arg(std::string_view data, std::size_t index) const;
+    std::optional<std::string_view> replyTo(std::string_view data) const;
+    std::string_view lineArg(std::string_view data) const;
+    Message header(std::string_view data) const;
+    MessageView view(std::string_view data) const;
+    Op op(std::string_view data) const;
+    std::expected<std::size_t, Error> streamChunk(std::string_view data, std::vector<Op>& ops);
+    MessageChunk chunk(std::string_view data) const;
+
+    State state_ = State::OpStart;
+    Kind kind_ = Kind::Msg;
+    /// number of bytes of the current operation processed so far.
+    std::size_t pos_ = 0;
+    std::size_t argsBegin_ = 0;
+    std::size_t lineEnd_ = 0;
+    std::array<Token, max_args> args_;
+    std::size_t argc_ = 0;
+    std::size_t payloadBegin_ = 0;
+    std::size_t headerSize_ = 0;
+    std::size_t payloadSize_ = 0;
+    std::optional<std::size_t> bytesNeeded_;
+    std::optional<Error> error_;
+    /// the largest total size of a message, 0 for no limit.
+    std::size_t maxPayload_ = 0;
+
+    /// the message being streamed; the strings keep their capacity between messages.
+    struct Stream {
+        std::string subject;
+        std::string sid;
+        std::string replyTo;
+        bool hasReplyTo = false;
+        std::string headers;
+        std::size_t offset = 0;
+        std::size_t size = 0;
+    } stream_;
 };
 
 } // namespace nats
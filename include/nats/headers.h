@@ -0,0 +1,84 @@
+#ifndef NATS_HEADERS_H
+#define NATS_HEADERS_H
+
+#include "core.h"
+#include "small_vector.h"
+
+#include <expected>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace nats {
+
+/// @brief  The headers of a message, decoded in place
+///
+/// The header block of an HMSG has the form
+///   NATS/1.0[ <status>[ <description>]]␍␊[<key>: <value>␍␊]*␍␊
+/// The fields are views into the block, held in a flat vector, so decoding
+/// a typical message does not allocate. Keys are compared case sensitively
+/// and a key may appear more than once.
+class HeaderView {
+public:
+    struct Field {
+        std::string_view key;
+        std::string_view value;
+    };
+
+    /// @brief  Decode a header block, e.g. MessageView::headers.
+    ///
+    /// An empty block gives no fields and no status.
+    static std::expected<HeaderView, Error> parse(std::string_view block);
+
+    /// @brief  The status code of the version line (e.g. 503), 0 when there is none.
+    int status() const { return status_; }
+    std::string_view description() const { return description_; }
+
+    /// @brief  The first value of a key.
+    std::optional<std::string_view> get(std::string_view key) const;
+
+    const Field* begin() const { return fields_.begin(); }
+    const Field* end() const { return fields_.end(); }
+    std::size_t size() const { return fields_.size(); }
+    bool empty() const { return fields_.empty(); }
+
+private:
+    int status_ = 0;
+    std::string_view description_;
+    SmallVector<Field, 8> fields_;
+};
+
+/// @brief  Encodes a header block for HPUB
+///
+/// The encoded block is kept in one string; clear() keeps its capacity so a
+/// builder reused for every publish stops allocating.
+class HeaderBuilder {
+public:
+    HeaderBuilder() { clear(); }
+
+    /// @brief  Set the status of the version line.
+    HeaderBuilder& status(int code, std::string_view description = {});
+
+    /// @brief  Append a field.
+    ///
+    /// Keys may not contain ':', spaces or line breaks and values may not
+    /// contain line breaks; an invalid field makes the builder invalid.
+    HeaderBuilder& add(std::string_view key, std::string_view value);
+
+    /// @brief  Remove the status and all fields.
+    void clear();
+
+    /// @brief  false when an invalid field was added.
+    bool valid() const { return valid_; }
+
+    /// @brief  The complete block, including the terminating empty line.
+    std::string_view encoded() const { return block_; }
+
+private:
+    std::string block_;
+    bool valid_ = true;
+};
+
+} // namespace nats
+
+#endif // NATS_HEADERS_H
@@ -0,0 +1,126 @@
+#ifndef NATS_INLINE_FUNCTION_H
+#define NATS_INLINE_FUNCTION_H
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace nats {
+
+template <typename Signature, std::size_t Capacity = 48>
+class InlineFunction;
+
+/// @brief  A move-only callable that keeps small targets inline
+///
+/// Targets of up to Capacity bytes that can be moved without throwing are
+/// stored in the object itself, so neither constructing nor calling it
+/// allocates; larger ones are moved to the heap once, when it is constructed.
+/// Unlike std::function the target does not have to be copyable, and it is
+/// called through a const InlineFunction even when its call operator is not const.
+template <typename R, typename... Args, std::size_t Capacity>
+class InlineFunction<R(Args...), Capacity> {
+public:
+    InlineFunction() noexcept = default;
+    InlineFunction(std::nullptr_t) noexcept {}
+
+    template <typename F>
+        requires (!std::is_same_v<std::remove_cvref_t<F>, InlineFunction> && std::is_invocable_r_v<R, std::decay_t<F>&, Args...>)
+    InlineFunction(F&& f) {
+        using T = std::decay_t<F>;
+        if constexpr (std::is_pointer_v<T> || std::is_member_pointer_v<T>) {
+            if (f == nullptr) {
+                return;
+            }
+        }
+        if constexpr (fits_inline<T>) {
+            ::new (static_cast<void*>(storage_)) T(std::forward<F>(f));
+            ops_ = &inline_ops<T>;
+        } else {
+            ::new (static_cast<void*>(storage_)) T*(new T(std::forward<F>(f)));
+            ops_ = &heap_ops<T>;
+        }
+    }
+
+    InlineFunction(const InlineFunction&) = delete;
+    InlineFunction& operator=(const InlineFunction&) = delete;
+    InlineFunction(InlineFunction&& other) noexcept { take(other); }
+    InlineFunction& operator=(InlineFunction&& other) noexcept {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+    InlineFunction& operator=(std::nullptr_t) noexcept {
+        reset();
+        return *this;
+    }
+    ~InlineFunction() { reset(); }
+
+    explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+    R operator()(Args... args) const {
+        return ops_->invoke(storage_, std::forward<Args>(args)...);
+    }
+
+private:
+    struct Ops {
+        R (*invoke)(void* target, Args&&... args);
+        /// move the target into empty storage and destroy the source.
+        void (*relocate)(void* from, void* to) noexcept;
+        void (*destroy)(void* target) noexcept;
+    };
+
+    template <typename T>
+    static constexpr bool fits_inline = sizeof(T) <= Capacity && alignof(T) <= alignof(std::max_align_t)
+        && std::is_nothrow_move_constructible_v<T>;
+
+    template <typename T>
+    static constexpr Ops inline_ops{
+        [](void* target, Args&&... args) -> R {
+            return std::invoke_r<R>(*static_cast<T*>(target), std::forward<Args>(args)...);
+        },
+        [](void* from, void* to) noexcept {
+            ::new (to) T(std::move(*static_cast<T*>(from)));
+            static_cast<T*>(from)->~T();
+        },
+        [](void* target) noexcept {
+            static_cast<T*>(target)->~T();
+        }
+    };
+
+    template <typename T>
+    static constexpr Ops heap_ops{
+        [](void* target, Args&&... args) -> R {
+            return std::invoke_r<R>(**static_cast<T**>(target), std::forward<Args>(args)...);
+        },
+        [](void* from, void* to) noexcept {
+            ::new (to) T*(*static_cast<T**>(from));
+        },
+        [](void* target) noexcept {
+            delete *static_cast<T**>(target);
+        }
+    };
+
+    void take(InlineFunction& other) noexcept {
+        if (other.ops_) {
+            other.ops_->relocate(other.storage_, storage_);
+            ops_ = std::exchange(other.ops_, nullptr);
+        }
+    }
+
+    void reset() noexcept {
+        if (ops_) {
+            std::exchange(ops_, nullptr)->destroy(storage_);
+        }
+    }
+
+    const Ops* ops_ = nullptr;
+    alignas(std::max_align_t) mutable std::byte storage_[Capacity];
+};
+
+} // namespace nats
+
+#endif // NATS_INLINE_FUNCTION_H
@@ -0,0 +1,45 @@
+#ifndef NATS_SCAN_H
+#define NATS_SCAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+/// Vectorized scanning of protocol control lines.
+///
+/// The implementation is chosen once at startup for the running CPU (AVX2 or
+/// SSE2 on x86-64, NEON on AArch64) with a scalar fallback.
+namespace nats::scan {
+
+struct Implementation {
+    const char* name;
+    /// offset of the first '\r' or '\n' in the bytes, or the size when there is none.
+    std::size_t (*findLineEnd)(const char* data, std::size_t size);
+    /// bit i is set when byte i is a space or tab, for the first 64 bytes at most.
+    std::uint64_t (*spaceMask)(const char* data, std::size_t size);
+};
+
+/// @brief  The implementations that can run on this CPU, best first.
+std::span<const Implementation> supported();
+
+/// @brief  The implementation used by findLineEnd() and spaceMask().
+const Implementation& active();
+
+/// @brief  Use another supported implementation (for tests and benchmarks).
+///
+/// This is not thread safe and should be done before any parsing starts.
+/// @return false when no supported implementation has that name.
+bool select(std::string_view name);
+
+inline std::size_t findLineEnd(std::string_view data) {
+    return active().findLineEnd(data.data(), data.size());
+}
+
+inline std::uint64_t spaceMask(std::string_view data) {
+    return active().spaceMask(data.data(), data.size());
+}
+
+} // namespace nats::scan
+
+#endif // NATS_SCAN_H
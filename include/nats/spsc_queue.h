@@ -0,0 +1,73 @@
+#ifndef NATS_SPSC_QUEUE_H
+#define NATS_SPSC_QUEUE_H
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace nats {
+
+/// @brief  A bounded lock-free queue for one producer and one consumer
+///
+/// The capacity is rounded up to a power of two. push() is only called from
+/// the producing thread and pop() from the consuming one; the consumer may
+/// change threads when the hand-over goes through an acquire/release pair.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(std::size_t capacity)
+        : mask_(std::bit_ceil(capacity < 2 ? std::size_t{2} : capacity) - 1), slots_(std::make_unique<std::optional<T>[]>(mask_ + 1)) {}
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /// @return false when the queue is full; the value is left untouched then.
+    bool push(T&& value) {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail - headCache_ > mask_) {
+            headCache_ = head_.load(std::memory_order_acquire);
+            if (tail - headCache_ > mask_) {
+                return false;
+            }
+        }
+        slots_[tail & mask_].emplace(std::move(value));
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::optional<T> pop() {
+        const auto head = head_.load(std::memory_order_relaxed);
+        if (head == tailCache_) {
+            tailCache_ = tail_.load(std::memory_order_acquire);
+            if (head == tailCache_) {
+                return std::nullopt;
+            }
+        }
+        auto& slot = slots_[head & mask_];
+        std::optional<T> value(std::move(slot));
+        slot.reset();
+        head_.store(head + 1, std::memory_order_release);
+        return value;
+    }
+
+    /// exact on either side while the other one is idle.
+    std::size_t size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+    std::size_t capacity() const { return mask_ + 1; }
+
+private:
+    const std::size_t mask_;
+    std::unique_ptr<std::optional<T>[]> slots_;
+    /// the consumer's index and its copy of the producer's, then the producer's,
+    /// each on its own cache line.
+    alignas(64) std::atomic<std::size_t> head_ = 0;
+    std::size_t tailCache_ = 0;
+    alignas(64) std::atomic<std::size_t> tail_ = 0;
+    std::size_t headCache_ = 0;
+};
+
+} // namespace nats
+
+#endif // NATS_SPSC_QUEUE_H
@@ -25,6 +25,24 @@ inline std::ostream& operator<<(std::ostream& os, const Message& msg)
     return os;
 }
 
+inline std::string to_string(const MessageView& msg)
+{
+    return "MessageView{" + std::string(msg.subject)
+        + "," + std::string(msg.sid)
+        + ",[" + std::string(msg.replyTo.value_or("{none}"))
+        + "]," + std::to_string(msg.payload.size())
+        + "," + std::string(msg.payload)
+        + "}";
+}
+
+inline std::ostream& operator<<(std::ostream& os, const MessageView& msg)
+{
+    if (os) {
+        os << to_string(msg);
+    }
+    return os;
+}
+
 inline std::string to_string(const MessageNeedsMoreData& nmd)
 {
     std::string str = "MessageNeedsMoreData{";
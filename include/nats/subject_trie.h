@@ -0,0 +1,58 @@
+#ifndef NATS_SUBJECT_TRIE_H
+#define NATS_SUBJECT_TRIE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace nats {
+
+/// @brief  Subject patterns indexed by token
+///
+/// Patterns are split on '.' into tokens; a `*` token matches any single
+/// token and a trailing `>` one or more. Each pattern holds the ids inserted
+/// with it. match() only walks the branches the tokens of a subject lead
+/// into, so its cost grows with the subject and the wildcards along its way,
+/// not with the number of patterns.
+class SubjectTrie {
+public:
+    typedef std::uint64_t Id;
+
+    SubjectTrie();
+    ~SubjectTrie();
+    SubjectTrie(const SubjectTrie&) = delete;
+    SubjectTrie& operator=(const SubjectTrie&) = delete;
+
+    /// @brief  Add an id to a pattern
+    /// @return false when the pattern is not valid.
+    bool insert(std::string_view pattern, Id id);
+
+    /// @brief  Remove an id from a pattern
+    /// @return false when the pattern does not hold the id.
+    bool erase(std::string_view pattern, Id id);
+
+    /// @brief  Append the ids of every pattern `subject` matches
+    ///
+    /// An id inserted with several patterns is appended once for each of
+    /// them that matches.
+    void match(std::string_view subject, std::vector<Id>& ids) const;
+
+    /// @brief  Number of ids inserted.
+    std::size_t size() const { return size_; }
+
+    /// @brief  A pattern has non-empty tokens without whitespace, wildcards
+    /// only as whole tokens, and `>` only as the last one.
+    static bool validPattern(std::string_view pattern);
+
+private:
+    struct Node;
+
+    std::unique_ptr<Node> root_;
+    std::size_t size_ = 0;
+};
+
+} // namespace nats
+
+#endif // NATS_SUBJECT_TRIE_H
@@ -0,0 +1,132 @@
+#ifndef NATS_WRITE_QUEUE_H
+#define NATS_WRITE_QUEUE_H
+
+#include <boost/asio/buffer.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nats {
+
+/// a payload shared with the caller; it is written without being copied.
+typedef std::shared_ptr<const std::string> SharedPayload;
+
+/// @brief  Frames waiting to be written to the server
+///
+/// Bytes queued while a write is in flight are sent together by the next
+/// write as one buffer sequence. Small pieces are copied into shared blocks so
+/// a burst of publishes becomes a few large buffers; larger ones are queued
+/// as segments of their own, and only copied when the caller keeps them.
+/// Blocks are reused once they are written.
+class WriteQueue {
+public:
+    /// pieces up to this size are coalesced into blocks of block_size.
+    static constexpr std::size_t coalesce_limit = 4096;
+    static constexpr std::size_t block_size = 64 * 1024;
+
+    WriteQueue() = default;
+    WriteQueue(const WriteQueue&) = delete;
+    WriteQueue& operator=(const WriteQueue&) = delete;
+
+    /// @brief  Copy bytes to the end of the queue.
+    void append(std::string_view bytes);
+
+    /// @brief  Queue bytes the queue takes over; large ones are not copied.
+    void push(std::string bytes);
+
+    /// @brief  Queue bytes that stay shared with the caller and are never copied.
+    void push(SharedPayload bytes);
+
+    /// @brief  true when nothing is waiting to be written.
+    bool empty() const { return queued_.empty(); }
+
+    /// @brief  Bytes waiting to be written, not counting the write in flight.
+    std::size_t queuedBytes() const { return queuedBytes_; }
+
+    /// @brief  Bytes waiting to be written and in the write in flight.
+    std::size_t pendingBytes() const { return queuedBytes_ + inflightBytes_; }
+
+    /// @brief  The largest piece queued as a segment of its own, 0 when
+    /// everything queued went into blocks.
+    std::size_t largestSegment() const { return largestSegment_; }
+
+    /// @brief  true between startWrite() and finishWrite().
+    bool writing() const { return writing_; }
+
+    /// @brief  Hand everything queued to a write
+    ///
+    /// The buffers and the bytes behind them stay valid until finishWrite().
+    /// @return The buffers to write with a single gather write.
+    const std::vector<boost::asio::const_buffer>& startWrite();
+
+    /// @brief  Release the segments of the completed write.
+    void finishWrite();
+
+    /// @brief  Keep the segments of the completed write until the kernel is done with them
+    ///
+    /// For a write sent with MSG_ZEROCOPY, which the kernel still reads from
+    /// after the write completes. Zero-copy sends are numbered from 0 per
+    /// socket; the segments are released once release() has reported every
+    /// send numbered below `until`.
+    void finishWrite(std::uint32_t until);
+
+    /// @brief  The kernel is done with the zero-copy sends numbered [first, last].
+    void release(std::uint32_t first, std::uint32_t last);
+
+    /// @brief  Drop everything waiting to be written
+    ///
+    /// The write in flight keeps its segments until finishWrite().
+    void clear();
+
+    /// @brief  Bytes of completed zero-copy writes the kernel has not released.
+    std::size_t pinnedBytes() const { return pinnedBytes_; }
+
+private:
+    struct Segment {
+        /// owned bytes; unused when shared is set.
+        std::string bytes;
+        SharedPayload shared;
+        /// a block that small pieces are appended to.
+        bool block = false;
+
+        std::string_view view() const { return shared ? std::string_view(*shared) : std::string_view(bytes); }
+    };
+
+    /// segments of a zero-copy write waiting for the kernel.
+    struct Pinned {
+        std::uint32_t until;
+        std::vector<Segment> segments;
+        std::size_t bytes;
+    };
+
+    /// the block to append `size` bytes to, started when the last segment is not one.
+    std::string& block(std::size_t size);
+    /// free the pinned writes the kernel is done with.
+    void releasePinned();
+    /// free written segments, keeping blocks for reuse.
+    void recycle(std::vector<Segment>& segments);
+
+    std::vector<Segment> queued_;
+    std::vector<Segment> inflight_;
+    /// written blocks, cleared but keeping their capacity.
+    std::vector<std::string> spare_;
+    std::vector<boost::asio::const_buffer> buffers_;
+    std::size_t queuedBytes_ = 0;
+    std::size_t inflightBytes_ = 0;
+    std::size_t largestSegment_ = 0;
+    bool writing_ = false;
+    std::deque<Pinned> pinned_;
+    std::size_t pinnedBytes_ = 0;
+    /// every zero-copy send numbered below this one is released.
+    std::uint32_t released_ = 0;
+    /// ranges reported ahead of released_.
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> early_;
+};
+
+} // namespace nats
+
+#endif // NATS_WRITE_QUEUE_H
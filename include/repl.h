@@ -3,6 +3,7 @@
 
 #include <string>
 #include <ostream>
+#include <vector>
 #include <boost/asio.hpp>
 #include "logging.h"
 #include "nats/client.h"
@@ -32,6 +33,9 @@ private:
     NATSClient& nats_client_;
     boost::asio::posix::stream_descriptor input_;
     boost::asio::streambuf buffer_;
+    /// the subscription of the last `sub`, and those answering `reply`.
+    NATSClient::Subscription subscription_;
+    std::vector<NATSClient::Subscription> replies_;
 };
 
 #endif // REPL_H
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "nats/buffer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+nats::SlabBuffer::SlabBuffer(std::size_t slabSize)
+    : slabSize_(slabSize), slab_(std::make_shared<Slab>(slabSize)) {}
+
+std::span<char> nats::SlabBuffer::prepare(std::size_t size) {
+    if (slab_->capacity() - end_ < size) {
+        const auto readable = end_ - begin_;
+        const auto needed = std::max(slabSize_, readable + size);
+        // an oversized slab left behind by a large message is not kept around.
+        if (slab_.use_count() == 1 && slab_->capacity() >= needed && (slab_->capacity() == slabSize_ || needed > slabSize_)) {
+            // no view refers to this slab: compact it in place.
+            std::memmove(slab_->data(), slab_->data() + begin_, readable);
+        } else {
+            auto next = std::make_shared<Slab>(needed);
+            std::memcpy(next->data(), slab_->data() + begin_, readable);
+            slab_ = std::move(next);
+        }
+        begin_ = 0;
+        end_ = readable;
+    }
+    return {slab_->data() + end_, slab_->capacity() - end_};
+}
+
+void nats::SlabBuffer::commit(std::size_t size) {
+    assert(end_ + size <= slab_->capacity());
+    end_ += size;
+}
+
+void nats::SlabBuffer::consume(std::size_t size) {
+    assert(begin_ + size <= end_);
+    begin_ += size;
+    if (begin_ == end_ && slab_.use_count() == 1) {
+        begin_ = end_ = 0;
+    }
+}
+
+std::expected<std::unique_ptr<nats::RingBuffer>, nats::Error> nats::RingBuffer::create(std::size_t capacity) {
+    const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    capacity = std::max(page, (capacity + page - 1) / page * page);
+    const auto base = map(capacity);
+    if (!base.has_value()) {
+        return std::unexpected(base.error());
+    }
+    return std::unique_ptr<RingBuffer>(new RingBuffer(base.value(), capacity));
+}
+
+std::expected<char*, nats::Error> nats::RingBuffer::map(std::size_t capacity) {
+    const auto failed = [](const char* what) {
+        return std::unexpected(Error{std::string(what) + ": " + std::strerror(errno)});
+    };
+    const int fd = ::memfd_create("nats-ring", MFD_CLOEXEC);
+    if (fd < 0) {
+        return failed("memfd_create");
+    }
+    if (::ftruncate(fd, static_cast<off_t>(capacity)) != 0) {
+        const auto error = failed("ftruncate");
+        ::close(fd);
+        return error;
+    }
+    // reserve both halves at once, then map the file over each of them.
+    auto* base = static_cast<char*>(::mmap(nullptr, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (base == MAP_FAILED) {
+        const auto error = failed("mmap");
+        ::close(fd);
+        return error;
+    }
+    for (auto* half : {base, base + capacity}) {
+        if (::mmap(half, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            const auto error = failed("mmap");
+            ::munmap(base, 2 * capacity);
+            ::close(fd);
+            return error;
+        }
+    }
+    // the mappings keep the memory alive.
+    ::close(fd);
+    return base;
+}
+
+nats::RingBuffer::~RingBuffer() {
+    ::munmap(base_, 2 * capacity_);
+}
+
+std::span<char> nats::RingBuffer::prepare(std::size_t size) {
+    const auto readable = end_ - begin_;
+    if (capacity_ - readable < size) {
+        // a frame larger than the ring: move to a ring that holds all of it.
+        const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        const auto capacity = std::max(2 * capacity_, (readable + size + page - 1) / page * page);
+        const auto base = map(capacity);
+        if (!base.has_value()) {
+            // like a slab that cannot be allocated.
+            throw std::bad_alloc();
+        }
+        std::memcpy(base.value(), base_ + begin_, readable);
+        ::munmap(base_, 2 * capacity_);
+        base_ = base.value();
+        capacity_ = capacity;
+        begin_ = 0;
+        end_ = readable;
+    }
+    return {base_ + end_, capacity_ - readable};
+}
+
+void nats::RingBuffer::commit(std::size_t size) {
+    assert(end_ - begin_ + size <= capacity_);
+    end_ += size;
+}
+
+void nats::RingBuffer::consume(std::size_t size) {
+    assert(begin_ + size <= end_);
+    begin_ += size;
+    if (begin_ >= capacity_) {
+        // the same bytes are mapped one ring length earlier.
+        begin_ -= capacity_;
+        end_ -= capacity_;
+    }
+}
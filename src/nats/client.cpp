@@ -1,11 +1,178 @@
 #include "nats/client.h"
+#include "nats/spsc_queue.h"
 #include "nats/stream.h"
 #include "simdjson.h"
+#include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <cstring>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <random>
+#include <sys/socket.h>
 #include <vector>
 
-NATSClient::NATSClient(net::io_context& io_context, const std::string& host, const std::string& port)
-    : io_context_(io_context), resolver_(io_context), socket_(io_context), host_(host), port_(port) {}
+namespace {
+
+/// @brief  A subject can be published to when its tokens are not empty and it
+/// has no wildcards or whitespace.
+bool isPublishSubject(std::string_view subject) {
+    if (subject.empty() || subject.front() == '.' || subject.back() == '.') {
+        return false;
+    }
+    for (std::size_t i = 0; i < subject.size(); ++i) {
+        switch (subject[i]) {
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+        case '*':
+        case '>':
+            return false;
+        case '.':
+            if (subject[i + 1] == '.') {
+                return false;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+/// append " <size>␍␊" to a queue.
+void writeSize(nats::WriteQueue& writes, std::size_t size) {
+    char digits[24];
+    digits[0] = ' ';
+    auto* end = std::to_chars(digits + 1, digits + sizeof(digits), size).ptr;
+    *end++ = '\r';
+    *end++ = '\n';
+    writes.append(std::string_view(digits, end - digits));
+}
+
+/// `_INBOX.` and 22 random base62 digits, about as many bits as a NUID.
+std::string randomInboxPrefix() {
+    constexpr std::string_view digits = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+    std::random_device random;
+    std::uniform_int_distribution<std::size_t> pick(0, digits.size() - 1);
+    std::string prefix = "_INBOX.";
+    for (std::size_t i = 0; i < 22; ++i) {
+        prefix += digits[pick(random)];
+    }
+    return prefix + '.';
+}
+
+/// room for the op, sizes and line ends of a control line.
+constexpr std::size_t control_overhead = 48;
+
+NATSClient::Sid makeSid(std::size_t slot, std::uint32_t generation) {
+    return (NATSClient::Sid{generation} << 32) | (slot + 1);
+}
+
+/// the slot of a sid, or a value past any slot for sid 0.
+std::size_t slotOf(NATSClient::Sid sid) {
+    return static_cast<std::size_t>(sid & 0xffffffff) - 1;
+}
+
+std::uint32_t generationOf(NATSClient::Sid sid) {
+    return static_cast<std::uint32_t>(sid >> 32);
+}
+
+/// append " <value>".
+void appendNumber(std::string& out, std::uint64_t value) {
+    char digits[24];
+    digits[0] = ' ';
+    const auto* end = std::to_chars(digits + 1, digits + sizeof(digits), value).ptr;
+    out.append(digits, end - digits);
+}
+
+/// messages a worker delivers from one queue before it lets others have a turn.
+constexpr std::size_t drain_batch = 64;
+
+/// a view of a message copied out of the receive buffer.
+nats::MessageView viewOf(const nats::Message& msg) {
+    nats::MessageView view{
+        .subject = msg.subject,
+        .sid = msg.sid,
+        .headers = msg.headers,
+        .payload = msg.payload
+    };
+    if (msg.replyTo.has_value()) {
+        view.replyTo = *msg.replyTo;
+    }
+    return view;
+}
+
+} // namespace
+
+struct NATSClient::Queued {
+    typedef NATSSubOptions::OnSlowConsumer OnSlowConsumer;
+
+    /// the messages of the subjects hashed to one partition.
+    struct alignas(64) Lane {
+        explicit Lane(std::size_t capacity) : queue(capacity) {}
+
+        nats::SpscQueue<Message> queue;
+        /// payload and header bytes in the queue.
+        std::atomic<std::size_t> bytes = 0;
+        /// set while a drain is posted or running, so one worker at a time
+        /// takes messages out; clearing and setting it hands the consumer side over.
+        std::atomic<bool> scheduled = false;
+        /// whether the last message found the lane at a limit, IO thread only.
+        bool full = false;
+    };
+
+    Queued(const NATSSubOptions& options, nats::InlineFunction<void(Message&&)> handler)
+        : handler(std::move(handler))
+        , maxMsgs(share(options.pendingMsgs, options.partitions))
+        , maxBytes(share(options.pendingBytes, options.partitions))
+        , onSlowConsumer(options.onSlowConsumer) {
+        for (std::size_t i = 0; i < std::max<std::size_t>(options.partitions, 1); ++i) {
+            // the headroom the worker drops the oldest messages from.
+            lanes.emplace_back(onSlowConsumer == OnSlowConsumer::DropOldest ? 2 * maxMsgs : maxMsgs);
+        }
+    }
+
+    /// a lane's part of a limit, 0 staying no limit.
+    static std::size_t share(std::size_t limit, std::size_t partitions) {
+        return limit == 0 ? 0 : std::max<std::size_t>((limit + partitions - 1) / std::max<std::size_t>(partitions, 1), 1);
+    }
+
+    /// whether the messages and bytes in a lane are past its limits.
+    bool over(std::size_t msgs, std::size_t totalBytes) const {
+        return msgs > maxMsgs || (maxBytes > 0 && totalBytes > maxBytes);
+    }
+
+    /// the lane the messages on a subject go through.
+    std::size_t lane(std::string_view subject) const {
+        return lanes.size() == 1 ? 0 : std::hash<std::string_view>{}(subject) % lanes.size();
+    }
+
+    nats::InlineFunction<void(Message&&)> handler;
+    /// the limits of each lane.
+    const std::size_t maxMsgs;
+    const std::size_t maxBytes;
+    const OnSlowConsumer onSlowConsumer;
+    std::deque<Lane> lanes;
+    std::atomic<std::uint64_t> dropped = 0;
+    std::atomic<bool> closed = false;
+};
+
+NATSClient::NATSClient(net::io_context& io_context, const std::string& host, const std::string& port, const NATSOptions& options)
+    : io_context_(io_context), resolver_(io_context), socket_(io_context), host_(host), port_(port), options_(options)
+    , inboxPrefix_(randomInboxPrefix()) {
+    if (options.receiveBuffer == NATSOptions::ReceiveBuffer::Ring) {
+        if (auto ring = nats::RingBuffer::create(options.ringSize); ring.has_value()) {
+            buffer_ = std::move(ring.value());
+        }
+    }
+    if (!buffer_) {
+        buffer_ = std::make_unique<nats::SlabBuffer>();
+    }
+    // until the server's INFO announces its own.
+    core_.setMaxPayload(NATSInfo{}.max_payload);
+}
 
 void NATSClient::start() {
     auto endpoints = resolver_.resolve(host_, port_);
@@ -23,47 +190,243 @@ void NATSClient::shutdown() {
     }
 }
 
-void NATSClient::send(const std::string& message) {
-    net::async_write(socket_, net::buffer(message),
-        [this](const boost::system::error_code& ec, std::size_t bytes_transferred) {
-            onWrite(ec, bytes_transferred);
+void NATSClient::send(std::string message) {
+    writes_.push(std::move(message));
+    writeQueued();
+}
+
+void NATSClient::writeQueued() {
+    if (closed_) {
+        writes_.clear();
+        queuedMsgs_ = 0;
+        return;
+    }
+    if (!writes_.writing() && corks_ == 0) {
+        doWrite();
+    }
+}
+
+NATSClient::Batch NATSClient::batch() {
+    cork();
+    return Batch(*this);
+}
+
+void NATSClient::cork() {
+    ++corks_;
+}
+
+void NATSClient::uncork() {
+    assert(corks_ > 0);
+    if (--corks_ == 0 && !writes_.empty()) {
+        writeQueued();
+    }
+}
+
+void NATSClient::doWrite() {
+    // one gather write for everything queued since the last write started.
+    ++stats_.writes;
+    inflightMsgs_ = queuedMsgs_;
+    queuedMsgs_ = 0;
+    zeroCopyWrite_ = zeroCopy_ && writes_.largestSegment() >= options_.zeroCopyMinSize;
+    const auto handler = [this](const boost::system::error_code& ec, std::size_t bytes_transferred) {
+        onWrite(ec, bytes_transferred);
+    };
+    if (zeroCopyWrite_) {
+        net::async_write(zeroCopySocket_, writes_.startWrite(), handler);
+    } else {
+        net::async_write(socket_, writes_.startWrite(), handler);
+    }
+}
+
+template <typename ConstBufferSequence, typename WriteHandler>
+void NATSClient::ZeroCopySocket::async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler) {
+    socket.async_send(buffers, MSG_ZEROCOPY,
+        [this, buffers, handler = std::forward<WriteHandler>(handler)](const boost::system::error_code& ec, std::size_t bytes_transferred) mutable {
+            if (ec == net::error::no_buffer_space) {
+                // out of socket memory to pin pages with; copy this part instead.
+                socket.async_send(buffers, std::move(handler));
+                return;
+            }
+            if (!ec) {
+                ++sends;
+            }
+            std::move(handler)(ec, bytes_transferred);
         });
 }
 
+void NATSClient::reapZeroCopy() {
+    readZeroCopyNotifications();
+    if (writes_.pinnedBytes() == 0 || zeroCopyWaiting_) {
+        return;
+    }
+    zeroCopyWaiting_ = true;
+    socket_.async_wait(tcp::socket::wait_error, [this](const boost::system::error_code& ec) {
+        zeroCopyWaiting_ = false;
+        if (!ec) {
+            reapZeroCopy();
+        }
+    });
+    // a notification queued before the wait started would not wake it.
+    readZeroCopyNotifications();
+}
+
+void NATSClient::readZeroCopyNotifications() {
+    char control[256];
+    for (;;) {
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (::recvmsg(socket_.native_handle(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return;
+        }
+        for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            const auto recvErr = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!recvErr) {
+                continue;
+            }
+            sock_extended_err err;
+            std::memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // the sends numbered [ee_info, ee_data] are done.
+            const auto sends = err.ee_data - err.ee_info + 1;
+            stats_.zeroCopyDone += sends;
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                stats_.zeroCopyCopied += sends;
+            }
+            writes_.release(err.ee_info, err.ee_data);
+        }
+    }
+}
+
 void NATSClient::close() {
     boost::system::error_code ec;
     socket_.close(ec);
     if (ec) {
         log_(LogLevel::ERROR, "Error closing socket: " + ec.message());
     }
+    // what was not written yet never will be; the write in flight is
+    // released when its completion runs.
+    closed_ = true;
+    writes_.clear();
+    queuedMsgs_ = 0;
+    failPending(net::error::not_connected);
+}
+
+void NATSClient::failPending(const boost::system::error_code& ec) {
+    while (!flushes_.empty()) {
+        const auto flush = std::move(flushes_.front());
+        flushes_.pop_front();
+        flush->complete(ec);
+    }
+    while (!blockedPubs_.empty()) {
+        const auto blocked = std::move(blockedPubs_.front());
+        blockedPubs_.pop_front();
+        blocked.done->complete(ec);
+    }
 }
 
 void NATSClient::onConnect(const boost::system::error_code& ec) {
     if (!ec) {
+        // writes are already coalesced by the write queue; Nagle would only delay PINGs.
+        boost::system::error_code ignored;
+        socket_.set_option(tcp::no_delay(true), ignored);
+        if (options_.zeroCopy) {
+            const int enable = 1;
+            zeroCopy_ = ::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0;
+            if (!zeroCopy_) {
+                log_(LogLevel::INFO, std::string("MSG_ZEROCOPY is not available: ") + std::strerror(errno));
+            }
+        }
         doRead();
     } else {
         log_(LogLevel::ERROR, "Error connecting to NATS server: " + ec.message());
     }
 }
 
-void NATSClient::onWrite(const boost::system::error_code& ec, std::size_t /*bytes_transferred*/) {
+void NATSClient::onWrite(const boost::system::error_code& ec, std::size_t bytes_transferred) {
+    if (zeroCopyWrite_) {
+        // the kernel numbers the sends with 32 bits.
+        stats_.zeroCopySends = zeroCopySocket_.sends;
+        writes_.finishWrite(static_cast<std::uint32_t>(zeroCopySocket_.sends));
+        reapZeroCopy();
+    } else {
+        writes_.finishWrite();
+    }
+    inflightMsgs_ = 0;
+    stats_.bytesWritten += bytes_transferred;
     if (ec) {
         log_(LogLevel::ERROR, "Error sending message to NATS server: " + ec.message());
+        return;
+    }
+    releaseBlocked();
+    if (!writes_.empty()) {
+        writeQueued();
     }
 }
 
 void NATSClient::doRead() {
-    net::async_read_until(socket_, response_, "\r\n",
-        [this](const boost::system::error_code& ec, std::size_t bytes_transferred) {
+    // the rest of a large message: the slab is sized for the whole frame
+    // and the payload is received straight into place behind the bytes
+    // already buffered, then parsed once when it is complete.
+    const auto whole = bytesNeeded_ > read_size;
+    auto space = buffer_->prepare(whole ? bytesNeeded_ : read_size);
+    if (whole) {
+        space = space.first(bytesNeeded_);
+    }
+    const auto read = [this, whole](const auto& buffer) {
+        const auto handler = [this](const boost::system::error_code& ec, std::size_t bytes_transferred) {
             onRead(ec, bytes_transferred);
-        });
+        };
+        if (whole) {
+            net::async_read(socket_, buffer, handler);
+        } else {
+            socket_.async_read_some(buffer, handler);
+        }
+    };
+#if defined(BOOST_ASIO_HAS_IO_URING)
+    if (const auto registered = registeredBuffer(space); registered.has_value()) {
+        read(*registered);
+        return;
+    }
+#endif
+    read(net::buffer(space.data(), space.size()));
+}
+
+#if defined(BOOST_ASIO_HAS_IO_URING)
+std::optional<net::mutable_registered_buffer> NATSClient::registeredBuffer(std::span<char> space) {
+    const auto region = buffer_->region();
+    if (!options_.registerBuffers || region.empty()) {
+        return std::nullopt;
+    }
+    if (region.data() != registered_.data() || region.size() != registered_.size()) {
+        // the ring was replaced by a larger one; only one registration per io_context.
+        registration_.reset();
+        registered_ = {};
+        try {
+            registration_.emplace(net::register_buffers(io_context_, net::buffer(region.data(), region.size())));
+            registered_ = region;
+        } catch (const boost::system::system_error& e) {
+            log_(LogLevel::ERROR, std::string("Error registering receive buffer: ") + e.what());
+            options_.registerBuffers = false;
+            return std::nullopt;
+        }
+    }
+    return net::buffer((*registration_)[0] + (space.data() - region.data()), space.size());
 }
+#endif
 
 void NATSClient::onRead(const boost::system::error_code& ec, std::size_t bytes_transferred) {
     if (!ec) {
+        buffer_->commit(bytes_transferred);
         if (evalResponse()) {
             log_(LogLevel::ERROR, "could not read response");
             close();
+        } else if (std::exchange(disconnect_, false)) {
+            log_(LogLevel::ERROR, "Closing the connection to a slow consumer");
+            close();
         } else {
             doRead();
         }
@@ -77,31 +440,62 @@ void NATSClient::onRead(const boost::system::error_code& ec, std::size_t bytes_t
 }
 
 bool NATSClient::evalResponse() {
-    auto error = false;
-    const auto next = response_.sgetc();
-    switch (next) {
-    case '+': // +OK
-        handleOk();
-        break;
-    case 'P': // PING
-        handlePing();
-        break;
-    case 'M': // MSG
-        handleMsg();
-        break;
-    case 'I': // INFO
-        handleInfo();
-        break;
-    case '-': // -ERR
-        handleErr();
-        break;
-    default:
-        log_(LogLevel::ERROR, "unexpected character: " + std::to_string(next));
-        error = true;
-        break;
-    };
-    return error;
+    const auto result = core_.handleOps(buffer_->data(), ops_);
+    // the views hold the slab before their bytes are consumed, which would
+    // otherwise let it be reused under a view a handler keeps.
+    for (auto& op : ops_) {
+        if (auto* msg = std::get_if<MessageView>(&op)) {
+            msg->slab = buffer_->slab();
+        }
+    }
+    if (result.has_value()) {
+        bytesNeeded_ = core_.bytesNeeded().value_or(0);
+        // the views stay readable until the buffer is prepared for the next read.
+        buffer_->consume(result.value());
+        streamPartial();
+    }
+
+    for (auto& op : ops_) {
+        if (const auto* msg = std::get_if<MessageView>(&op)) {
+            handleMsgPayload(*msg);
+        } else if (std::holds_alternative<nats::Ping>(op)) {
+            handlePing();
+        } else if (std::holds_alternative<nats::Pong>(op)) {
+            handlePong();
+        } else if (std::holds_alternative<nats::Ok>(op)) {
+            handleOk();
+        } else if (const auto* info = std::get_if<nats::Info>(&op)) {
+            handleInfo(*info);
+        } else if (const auto* err = std::get_if<nats::Err>(&op)) {
+            handleErr(*err);
+        } else if (const auto* chunk = std::get_if<nats::MessageChunk>(&op)) {
+            handleMsgChunk(*chunk);
+        }
+    }
+    // release the slab references so the slab can be compacted.
+    ops_.clear();
+    // the operations ahead of the error were still sent as they should be.
+    if (!result.has_value()) {
+        log_(LogLevel::ERROR, "stream error reading response: " + result.error().what);
+        return true;
+    }
+    return false;
 }
+
+void NATSClient::streamPartial() {
+    const auto msg = core_.partial(buffer_->data());
+    if (!msg.has_value()) {
+        return;
+    }
+    const auto index = findSlot(msg->sid);
+    if (index == no_slot || !std::holds_alternative<MessageChunkHandler>(slots_[index].handler)) {
+        return;
+    }
+    // the payload is consumed as it arrives, so reads never need room for all of it.
+    buffer_->consume(core_.stream(buffer_->data(), ops_));
+    bytesNeeded_ = 0;
+}
+
 void NATSClient::connect(const NATSInfo& info) {
     log_(LogLevel::INFO, "connected to server name " + info.server_name);
     const auto connect_msg = "CONNECT {\"verbose\":true,\"pedantic\":false,\"tls_required\":false,\"name\":\"nats-client\",\"lang\":\"cpp\",\"version\":\"0.1.0\"}\r\n";
@@ -118,183 +512,674 @@ void NATSClient::pong() {
     send(pong_msg);
 }
 
-void NATSClient::pub(const Message& msg) {
-    auto pub_msg = "PUB " + msg.subject;
-    if (msg.replyTo.has_value()) {
-        pub_msg += " " + *msg.replyTo;
+NATSClient::PubResult NATSClient::pub(const Message& msg) {
+    if (auto admitted = admit(frameSize(msg)); !admitted.has_value()) {
+        return admitted;
+    }
+    enqueue(msg);
+    return {};
+}
+
+NATSClient::PubResult NATSClient::pub(Message&& msg) {
+    if (auto admitted = admit(frameSize(msg)); !admitted.has_value()) {
+        return admitted;
     }
-    pub_msg += " " + std::to_string(msg.payload.size()) + "\r\n" + msg.payload + "\r\n";
-    send(pub_msg);
+    enqueue(std::move(msg));
+    return {};
 }
 
-void NATSClient::hpub(const std::string& subject) {
-    const auto hpub_msg = "HPUB " + subject + " 5\r\nhello\r\n";
-    send(hpub_msg);
+NATSClient::PubResult NATSClient::pub(const std::string& subject, const nats::SharedPayload& payload, const std::optional<std::string>& replyTo) {
+    const auto size = subject.size() + replyTo.value_or("").size() + payload->size() + control_overhead;
+    if (auto admitted = admit(size); !admitted.has_value()) {
+        return admitted;
+    }
+    writeControl("PUB ", subject, replyTo, std::nullopt, payload->size());
+    writes_.push(payload);
+    writes_.append("\r\n");
+    ++queuedMsgs_;
+    writeQueued();
+    return {};
 }
 
-void NATSClient::sub(const Subscription& subscription, const MessageHandler& handler) {
-    handlers_.insert({subscription.sid, handler});
+NATSClient::PubResult NATSClient::pub(std::string_view subject, std::string&& payload, const std::optional<std::string>& replyTo) {
+    const auto size = subject.size() + replyTo.value_or("").size() + payload.size() + control_overhead;
+    if (auto admitted = admit(size); !admitted.has_value()) {
+        return admitted;
+    }
+    writeControl("PUB ", subject, replyTo, std::nullopt, payload.size());
+    writes_.push(std::move(payload));
+    writes_.append("\r\n");
+    ++queuedMsgs_;
+    writeQueued();
+    return {};
+}
 
-    auto sub_msg = "SUB " + subscription.subject;
-    if (subscription.queueGroup.has_value()) {
-        sub_msg += " " + subscription.queueGroup.value();
+NATSClient::PubResult NATSClient::pub(std::string_view subject, std::span<const std::byte> payload, const std::optional<std::string>& replyTo) {
+    const auto size = subject.size() + replyTo.value_or("").size() + payload.size() + control_overhead;
+    if (auto admitted = admit(size); !admitted.has_value()) {
+        return admitted;
     }
-    sub_msg += " " + subscription.sid + "\r\n";
-    send(sub_msg);
+    writeControl("PUB ", subject, replyTo, std::nullopt, payload.size());
+    writes_.append(std::string_view(reinterpret_cast<const char*>(payload.data()), payload.size()));
+    writes_.append("\r\n");
+    ++queuedMsgs_;
+    writeQueued();
+    return {};
 }
 
-void NATSClient::unsub(const std::string& sid) {
-    const auto unsub_msg = "UNSUB " + sid + "\r\n";
-    send(unsub_msg);
+NATSClient::PubResult NATSClient::pubMany(std::span<const Message> msgs) {
+    std::size_t size = 0;
+    for (const auto& msg : msgs) {
+        size += frameSize(msg);
+    }
+    if (auto admitted = admit(size, msgs.size()); !admitted.has_value()) {
+        return admitted;
+    }
+    for (const auto& msg : msgs) {
+        encode(msg);
+    }
+    writeQueued();
+    return {};
 }
 
-void NATSClient::handleErr() {
-    std::istream is(&response_);
-    std::string cmd;
-    std::getline(is, cmd);
-    log_(LogLevel::INFO, cmd);
+void NATSClient::encode(const Message& msg) {
+    if (!msg.headers.empty()) {
+        hpub(msg, msg.headers);
+        return;
+    }
+    writeControl("PUB ", msg.subject, msg.replyTo, std::nullopt, msg.payload.size());
+    writes_.append(msg.payload);
+    writes_.append("\r\n");
+    ++queuedMsgs_;
 }
 
-void NATSClient::handleOk() {
-    std::istream is(&response_);
-    std::string cmd;
-    std::getline(is, cmd);
-    log_(LogLevel::INFO, cmd);
-}
-
-void NATSClient::handleInfo() {
-    std::istream is(&response_);
-    std::string cmd;
-    is >> cmd;
-    log_(LogLevel::INFO, cmd);
-    if (cmd == "INFO") {
-        if (const auto result = parseInfo(is); result.has_value()) {
-            auto info = result.value();
-            info.verbose = true;
-            connect(info);
-        } else {
-            log_(LogLevel::ERROR, "error parsing info: " + result.error().message);
+void NATSClient::enqueue(const Message& msg) {
+    encode(msg);
+    writeQueued();
+}
+
+void NATSClient::enqueue(Message&& msg) {
+    if (!msg.headers.empty()) {
+        hpub(msg, msg.headers);
+        writeQueued();
+        return;
+    }
+    writeControl("PUB ", msg.subject, msg.replyTo, std::nullopt, msg.payload.size());
+    writes_.push(std::move(msg.payload));
+    writes_.append("\r\n");
+    ++queuedMsgs_;
+    writeQueued();
+}
+
+std::size_t NATSClient::frameSize(const Message& msg) {
+    return msg.subject.size() + msg.replyTo.value_or("").size() + msg.headers.size() + msg.payload.size() + control_overhead;
+}
+
+NATSClient::PubResult NATSClient::admit(std::size_t bytes, std::size_t msgs) {
+    if (closed_) {
+        return std::unexpected(NATSError{"not connected"});
+    }
+    if (!full(bytes, msgs)) {
+        return {};
+    }
+    if (options_.onFull == NATSOptions::OnFull::Fail) {
+        return std::unexpected(NATSError{"outbound queue is full"});
+    }
+    // blocking inside a handler would wait for writes that can only finish
+    // once the handler returns.
+    if (io_context_.get_executor().running_in_this_thread()) {
+        return std::unexpected(NATSError{"outbound queue is full and cannot block inside the io_context"});
+    }
+    const auto deadline = std::chrono::steady_clock::now() + options_.blockTimeout;
+    while (!belowLowWater() || !blockedPubs_.empty()) {
+        if (closed_) {
+            return std::unexpected(NATSError{"not connected"});
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return std::unexpected(NATSError{"timed out waiting for the outbound queue"});
         }
+        // stopped by the application, which is not for a publish to undo.
+        if (io_context_.stopped()) {
+            return std::unexpected(NATSError{"outbound queue is full and the io_context is stopped"});
+        }
+        io_context_.run_one_until(deadline);
     }
+    return {};
 }
 
-void NATSClient::handlePing() {
-    std::istream is(&response_);
-    std::string cmd;
-    std::getline(is, cmd);
-    log_(LogLevel::INFO, cmd);
-    if (cmd == "PING") {
-        pong();
+bool NATSClient::full(std::size_t bytes, std::size_t msgs) const {
+    // later publishes queue behind the ones already waiting.
+    return !blockedPubs_.empty() || aboveHighWater(bytes, msgs);
+}
+
+bool NATSClient::aboveHighWater(std::size_t bytes, std::size_t msgs) const {
+    const auto depth = pending();
+    const auto maxBytes = options_.maxPendingBytes;
+    const auto maxMsgs = options_.maxPendingMsgs;
+    return (maxBytes > 0 && depth.bytes > 0 && depth.bytes + bytes > maxBytes)
+        || (maxMsgs > 0 && depth.msgs > 0 && depth.msgs + msgs > maxMsgs);
+}
+
+bool NATSClient::belowLowWater() const {
+    const auto depth = pending();
+    const auto lowBytes = options_.lowPendingBytes > 0 ? options_.lowPendingBytes : options_.maxPendingBytes / 2;
+    const auto lowMsgs = options_.lowPendingMsgs > 0 ? options_.lowPendingMsgs : options_.maxPendingMsgs / 2;
+    return (options_.maxPendingBytes == 0 || depth.bytes <= lowBytes)
+        && (options_.maxPendingMsgs == 0 || depth.msgs <= lowMsgs);
+}
+
+void NATSClient::releaseBlocked() {
+    if (blockedPubs_.empty() || !belowLowWater()) {
+        return;
+    }
+    while (!blockedPubs_.empty() && !aboveHighWater(frameSize(blockedPubs_.front().msg))) {
+        auto blocked = std::move(blockedPubs_.front());
+        blockedPubs_.pop_front();
+        enqueue(std::move(blocked.msg));
+        blocked.done->complete({});
+    }
+}
+
+std::expected<NATSClient::Publisher, NATSError> NATSClient::publisher(const std::string& subject, const std::optional<std::string>& replyTo) {
+    if (!isPublishSubject(subject)) {
+        return std::unexpected(NATSError{"invalid subject: " + subject});
+    }
+    if (replyTo.has_value() && !isPublishSubject(*replyTo)) {
+        return std::unexpected(NATSError{"invalid reply subject: " + *replyTo});
+    }
+    auto prefix = "PUB " + subject;
+    if (replyTo.has_value()) {
+        prefix += " " + *replyTo;
+    }
+    return Publisher(*this, std::move(prefix));
+}
+
+void NATSClient::Publisher::writeControl(std::size_t size) {
+    client_->writes_.append(prefix_);
+    writeSize(client_->writes_, size);
+}
+
+NATSClient::PubResult NATSClient::Publisher::pub(std::string_view payload) {
+    if (auto admitted = client_->admit(prefix_.size() + payload.size() + control_overhead); !admitted.has_value()) {
+        return admitted;
+    }
+    writeControl(payload.size());
+    client_->writes_.append(payload);
+    client_->writes_.append("\r\n");
+    ++client_->queuedMsgs_;
+    client_->writeQueued();
+    return {};
+}
+
+NATSClient::PubResult NATSClient::Publisher::pub(const nats::SharedPayload& payload) {
+    if (auto admitted = client_->admit(prefix_.size() + payload->size() + control_overhead); !admitted.has_value()) {
+        return admitted;
+    }
+    writeControl(payload->size());
+    client_->writes_.push(payload);
+    client_->writes_.append("\r\n");
+    ++client_->queuedMsgs_;
+    client_->writeQueued();
+    return {};
+}
+
+NATSClient::PubResult NATSClient::hpub(const Message& msg, const nats::HeaderBuilder& headers) {
+    if (!headers.valid()) {
+        return std::unexpected(NATSError{"invalid headers for " + msg.subject});
+    }
+    if (auto admitted = admit(frameSize(msg) + headers.encoded().size()); !admitted.has_value()) {
+        return admitted;
+    }
+    hpub(msg, headers.encoded());
+    writeQueued();
+    return {};
+}
+
+void NATSClient::hpub(const Message& msg, std::string_view headers) {
+    // HPUB <subject> [reply-to] <#header bytes> <#total bytes>␍␊[headers]␍␊␍␊[payload]␍␊
+    writeControl("HPUB ", msg.subject, msg.replyTo, headers.size(), headers.size() + msg.payload.size());
+    writes_.append(headers);
+    writes_.append(msg.payload);
+    writes_.append("\r\n");
+    ++queuedMsgs_;
+}
+
+void NATSClient::writeControl(std::string_view op, std::string_view subject, const std::optional<std::string>& replyTo,
+        std::optional<std::size_t> headerSize, std::size_t totalSize) {
+    // <op> <subject> [reply-to] [#header bytes] <#total bytes>␍␊
+    writes_.append(op);
+    writes_.append(subject);
+    if (replyTo.has_value()) {
+        writes_.append(" ");
+        writes_.append(*replyTo);
+    }
+    if (headerSize.has_value()) {
+        char digits[24];
+        digits[0] = ' ';
+        const auto* end = std::to_chars(digits + 1, digits + sizeof(digits), *headerSize).ptr;
+        writes_.append(std::string_view(digits, end - digits));
+    }
+    writeSize(writes_, totalSize);
+}
+
+NATSClient::Subscription NATSClient::sub(std::string_view subject, MessageHandler handler, const NATSSubOptions& options) {
+    if (options.pendingMsgs > 0) {
+        return subscribe(subject, options.queueGroup, makeQueued(options, [handler = std::move(handler)](Message&& msg) {
+            handler(msg);
+        }), options.autoUnsubscribe);
+    }
+    return subscribe(subject, options.queueGroup, MessageViewHandler([handler = std::move(handler)](const MessageView& msg) {
+        handler(msg.toMessage());
+    }), options.autoUnsubscribe);
+}
+
+NATSClient::Subscription NATSClient::sub(std::string_view subject, MessageViewHandler handler, const NATSSubOptions& options) {
+    if (options.pendingMsgs > 0) {
+        return subscribe(subject, options.queueGroup, makeQueued(options, [handler = std::move(handler)](Message&& msg) {
+            handler(viewOf(msg));
+        }), options.autoUnsubscribe);
+    }
+    return subscribe(subject, options.queueGroup, std::move(handler), options.autoUnsubscribe);
+}
+
+NATSClient::Subscription NATSClient::sub(std::string_view subject, MessageChunkHandler handler, const NATSSubOptions& options) {
+    return subscribe(subject, options.queueGroup, std::move(handler), options.autoUnsubscribe);
+}
+
+NATSClient::Subscription NATSClient::subRouted(std::string_view subject, const std::optional<std::string>& queueGroup) {
+    return subscribe(subject, queueGroup, Routed{});
+}
+
+std::expected<NATSClient::RouteId, NATSError> NATSClient::route(std::string_view pattern, MessageViewHandler handler) {
+    const auto id = nextRoute_++;
+    if (!routes_.insert(pattern, id)) {
+        return std::unexpected(NATSError{"invalid subject pattern: " + std::string(pattern)});
+    }
+    routeHandlers_.emplace(id, Route{std::string(pattern), std::move(handler)});
+    return id;
+}
+
+void NATSClient::unroute(RouteId id) {
+    const auto it = routeHandlers_.find(id);
+    if (it == routeHandlers_.end()) {
+        return;
+    }
+    routes_.erase(it->second.pattern, id);
+    if (dispatching_) {
+        // the handler may be the one running.
+        unrouted_.push_back(id);
+    } else {
+        routeHandlers_.erase(it);
+    }
+}
+
+void NATSClient::dispatchRoutes(const MessageView& msg) {
+    matched_.clear();
+    routes_.match(msg.subject, matched_);
+    dispatching_ = true;
+    for (const auto id : matched_) {
+        if (std::ranges::find(unrouted_, id) != unrouted_.end()) {
+            continue;
+        }
+        // routes added by a handler do not move the ones already stored.
+        if (const auto it = routeHandlers_.find(id); it != routeHandlers_.end()) {
+            it->second.handler(msg);
+        }
+    }
+    dispatching_ = false;
+    for (const auto id : unrouted_) {
+        routeHandlers_.erase(id);
+    }
+    unrouted_.clear();
+}
+
+NATSClient::Subscription NATSClient::subscribe(std::string_view subject, const std::optional<std::string>& queueGroup, Handler handler,
+    std::uint64_t max) {
+    std::size_t index = slots_.size();
+    if (!freeSlots_.empty()) {
+        index = freeSlots_.back();
+        freeSlots_.pop_back();
+    } else {
+        slots_.emplace_back();
     }
+    auto& slot = slots_[index];
+    slot.active = true;
+    slot.handler = std::move(handler);
+    slot.received = 0;
+    slot.max = max;
+    const auto sid = makeSid(index, slot.generation);
+
+    std::string sub_msg = "SUB ";
+    sub_msg += subject;
+    if (queueGroup.has_value()) {
+        sub_msg += " " + queueGroup.value();
+    }
+    appendNumber(sub_msg, sid);
+    sub_msg += "\r\n";
+    if (max > 0) {
+        // in the same write, so the server has the limit before any message.
+        sub_msg += "UNSUB";
+        appendNumber(sub_msg, sid);
+        appendNumber(sub_msg, max);
+        sub_msg += "\r\n";
+    }
+    send(std::move(sub_msg));
+    return Subscription(*this, sid);
+}
+
+std::size_t NATSClient::findSlot(Sid sid) const {
+    const auto index = slotOf(sid);
+    if (index >= slots_.size()) {
+        return no_slot;
+    }
+    const auto& slot = slots_[index];
+    return slot.active && slot.generation == generationOf(sid) ? index : no_slot;
+}
+
+std::size_t NATSClient::findSlot(std::string_view sid) const {
+    Sid value = 0;
+    const auto [end, ec] = std::from_chars(sid.data(), sid.data() + sid.size(), value);
+    if (ec != std::errc() || end != sid.data() + sid.size()) {
+        return no_slot;
+    }
+    return findSlot(value);
 }
 
-std::expected<NATSInfo, NATSError> NATSClient::parseInfo(std::istream& is) {
-    std::string info_json;
-    if (!std::getline(is, info_json)) {
-        return std::unexpected(NATSError{"info payload stream error"});
+void NATSClient::releaseSlot(std::size_t index) {
+    slots_[index].handler = Handler{};
+    freeSlots_.push_back(static_cast<std::uint32_t>(index));
+}
+
+void NATSClient::endSlot(std::size_t index) {
+    auto& slot = slots_[index];
+    slot.active = false;
+    // later messages for this sid no longer match the slot.
+    ++slot.generation;
+    if (index == delivering_) {
+        releaseDelivering_ = true;
+    } else {
+        releaseSlot(index);
     }
+}
 
+void NATSClient::countMessage(std::size_t index) {
+    auto& slot = slots_[index];
+    if (++slot.received == slot.max) {
+        // the server has ended it already; a queue still delivers what it holds.
+        endSlot(index);
+    }
+}
+
+void NATSClient::unsub(Sid sid) {
+    const auto index = findSlot(sid);
+    if (index == no_slot) {
+        return;
+    }
+    if (const auto* queued = std::get_if<std::shared_ptr<Queued>>(&slots_[index].handler)) {
+        // a worker still holding the queue drops what is left in it.
+        (*queued)->closed.store(true, std::memory_order_release);
+    }
+    endSlot(index);
+
+    std::string unsub_msg = "UNSUB";
+    appendNumber(unsub_msg, sid);
+    unsub_msg += "\r\n";
+    send(std::move(unsub_msg));
+}
+
+void NATSClient::unsub(Sid sid, std::uint64_t max) {
+    const auto index = findSlot(sid);
+    if (index == no_slot) {
+        return;
+    }
+    auto& slot = slots_[index];
+    if (slot.received >= max) {
+        unsub(sid);
+        return;
+    }
+    slot.max = max;
+    std::string unsub_msg = "UNSUB";
+    appendNumber(unsub_msg, sid);
+    appendNumber(unsub_msg, max);
+    unsub_msg += "\r\n";
+    send(std::move(unsub_msg));
+}
+
+NATSClient::Pending NATSClient::pending(Sid sid) const {
+    const auto index = findSlot(sid);
+    if (index == no_slot) {
+        return {};
+    }
+    if (const auto* queued = std::get_if<std::shared_ptr<Queued>>(&slots_[index].handler)) {
+        Pending pending;
+        for (const auto& lane : (*queued)->lanes) {
+            pending.bytes += lane.bytes.load(std::memory_order_relaxed);
+            pending.msgs += lane.queue.size();
+        }
+        return pending;
+    }
+    return {};
+}
+
+std::uint64_t NATSClient::dropped(Sid sid) const {
+    const auto index = findSlot(sid);
+    if (index == no_slot) {
+        return 0;
+    }
+    if (const auto* queued = std::get_if<std::shared_ptr<Queued>>(&slots_[index].handler)) {
+        return (*queued)->dropped.load(std::memory_order_relaxed);
+    }
+    return 0;
+}
+
+std::shared_ptr<NATSClient::Queued> NATSClient::makeQueued(const NATSSubOptions& options, nats::InlineFunction<void(Message&&)> handler) {
+    if (!workers_) {
+        workers_ = std::make_unique<net::thread_pool>(std::max<std::size_t>(options_.workers, 1));
+    }
+    return std::make_shared<Queued>(options, std::move(handler));
+}
+
+void NATSClient::enqueue(const std::shared_ptr<Queued>& queued, Sid sid, const MessageView& msg) {
+    const auto index = queued->lane(msg.subject);
+    auto& lane = queued->lanes[index];
+    const auto bytes = msg.payload.size() + msg.headers.size();
+    const auto pendingBytes = lane.bytes.load(std::memory_order_relaxed);
+    const auto over = queued->over(lane.queue.size() + 1, pendingBytes + bytes);
+    if (!over) {
+        lane.full = false;
+    } else if (!std::exchange(lane.full, true)) {
+        log_(LogLevel::WARN, "Slow consumer on sid " + std::to_string(sid) + ", dropping messages");
+        if (errorHandler_) {
+            net::post(io_context_, [handler = errorHandler_, sid] {
+                handler(sid, NATSError{"slow consumer, pending limits reached on sid " + std::to_string(sid)});
+            });
+        }
+    }
+    if (over && queued->onSlowConsumer != Queued::OnSlowConsumer::DropOldest) {
+        queued->dropped.fetch_add(1, std::memory_order_relaxed);
+        disconnect_ = disconnect_ || queued->onSlowConsumer == Queued::OnSlowConsumer::Disconnect;
+        return;
+    }
+    // past the headroom of DropOldest, the newest is dropped after all.
+    const auto headroom = queued->maxBytes > 0 && pendingBytes + bytes > 2 * queued->maxBytes;
+    // counted first, so that a worker taking the message out never goes below zero.
+    lane.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    if (headroom || !lane.queue.push(msg.toMessage())) {
+        lane.bytes.fetch_sub(bytes, std::memory_order_relaxed);
+        queued->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (!lane.scheduled.exchange(true, std::memory_order_acq_rel)) {
+        net::post(*workers_, [queued, index, pool = workers_.get()] {
+            drain(queued, index, *pool);
+        });
+    }
+}
+
+void NATSClient::drain(const std::shared_ptr<Queued>& queued, std::size_t index, net::thread_pool& pool) {
+    auto& lane = queued->lanes[index];
+    while (true) {
+        std::size_t delivered = 0;
+        for (; delivered < drain_batch; ++delivered) {
+            auto msg = lane.queue.pop();
+            if (!msg.has_value()) {
+                break;
+            }
+            const auto bytes = lane.bytes.fetch_sub(msg->payload.size() + msg->headers.size(), std::memory_order_relaxed);
+            if (queued->onSlowConsumer == Queued::OnSlowConsumer::DropOldest && queued->over(lane.queue.size() + 1, bytes)) {
+                // older than the limits allow to be behind.
+                queued->dropped.fetch_add(1, std::memory_order_relaxed);
+            } else if (!queued->closed.load(std::memory_order_acquire)) {
+                queued->handler(std::move(*msg));
+            }
+        }
+        if (delivered == drain_batch) {
+            // give the other queues a turn on this worker.
+            net::post(pool, [queued, index, &pool] {
+                drain(queued, index, pool);
+            });
+            return;
+        }
+        // an exchange, so that a message pushed before it is seen below.
+        lane.scheduled.exchange(false, std::memory_order_acq_rel);
+        if (lane.queue.empty() || lane.scheduled.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+    }
+}
+
+void NATSClient::Subscription::unsubscribe() {
+    if (client_) {
+        std::exchange(client_, nullptr)->unsub(sid_);
+    }
+}
+
+NATSClient::Sid NATSClient::Subscription::release() {
+    client_ = nullptr;
+    return sid_;
+}
+
+void NATSClient::handleErr(const nats::Err& err) {
+    log_(LogLevel::INFO, "-ERR " + std::string(err.message));
+}
+
+void NATSClient::handleOk() {
+    log_(LogLevel::INFO, "+OK");
+}
+
+void NATSClient::handleInfo(const nats::Info& info) {
+    log_(LogLevel::INFO, "INFO");
+    if (const auto result = parseInfo(info.json); result.has_value()) {
+        auto server = result.value();
+        server.verbose = true;
+        core_.setMaxPayload(server.max_payload);
+        connect(server);
+    } else {
+        log_(LogLevel::ERROR, "error parsing info: " + result.error().message);
+    }
+}
+
+void NATSClient::handlePing() {
+    log_(LogLevel::INFO, "PING");
+    pong();
+}
+
+void NATSClient::handlePong() {
+    log_(LogLevel::INFO, "PONG");
+    if (!flushes_.empty()) {
+        const auto flush = std::move(flushes_.front());
+        flushes_.pop_front();
+        flush->complete({});
+    }
+}
+
+std::expected<NATSInfo, NATSError> NATSClient::parseInfo(std::string_view info_json) {
     simdjson::ondemand::document doc;
     simdjson::ondemand::parser parser;
     try {
         simdjson::padded_string payload(info_json);
         doc = parser.iterate(payload);
-        return NATSInfo{.server_name{std::string_view(doc["server_name"])}};
+        NATSInfo info{.server_name = std::string(std::string_view(doc["server_name"]))};
+        if (std::uint64_t max_payload = 0; doc["max_payload"].get(max_payload) == simdjson::SUCCESS) {
+            info.max_payload = max_payload;
+        }
+        return info;
     } catch (simdjson::simdjson_error& error) {
         const char* current_location = doc.current_location();
-        log_(LogLevel::ERROR, "JSON error: " + std::string(error.what()) + " near " + current_location + " in " + info_json);
+        log_(LogLevel::ERROR, "JSON error: " + std::string(error.what()) + " near " + current_location + " in " + std::string(info_json));
         return std::unexpected(NATSError{error.what()});
     }
 }
 
-void NATSClient::handleMsg() {
-    log_(LogLevel::INFO, "MSG");
-    if (const auto result = core_.handleMsg(response_); result.has_value()) {
-        const auto& ok = result.value();
-        if (std::holds_alternative<Message>(ok)) {
-            handleMsgPayload(std::get<Message>(ok));
-        } else if (std::holds_alternative<nats::MessageNeedsMoreData>(ok)) {
-            const auto& nmd = std::get<nats::MessageNeedsMoreData>(ok);
-            if (nmd.bytes.has_value()) {
-                log_(LogLevel::INFO, "need " + std::to_string(nmd.bytes.value()) + " more bytes.");
-            }
-            log_(LogLevel::ERROR, "need to implement support for partial reads. " + to_string(nmd));
-            close();
+void NATSClient::handleMsgPayload(const MessageView& msg) {
+    const auto index = findSlot(msg.sid);
+    if (index == no_slot) {
+        log_(LogLevel::INFO, "No handler for message with sid " + std::string(msg.sid));
+        return;
+    }
+    const auto& handler = slots_[index].handler;
+    // taken before the last message of an auto-unsubscribe ends the slot.
+    const auto sid = makeSid(index, slots_[index].generation);
+    deliver(index, [&] {
+        countMessage(index);
+        if (const auto* view = std::get_if<MessageViewHandler>(&handler)) {
+            (*view)(msg);
+        } else if (const auto* queued = std::get_if<std::shared_ptr<Queued>>(&handler)) {
+            enqueue(*queued, sid, msg);
+        } else if (std::holds_alternative<Routed>(handler)) {
+            dispatchRoutes(msg);
         } else {
-            log_(LogLevel::ERROR, "unhandled type");
-            close();
+            // a message that arrived whole is a single chunk.
+            std::get<MessageChunkHandler>(handler)(nats::MessageChunk{
+                .subject = msg.subject,
+                .sid = msg.sid,
+                .replyTo = msg.replyTo,
+                .headers = msg.headers,
+                .data = msg.payload,
+                .size = msg.payload.size()
+            });
         }
-    } else {
-        log_(LogLevel::ERROR, "stream error reading message: " + result.error().what);
-        close();
-    }
+    });
 }
-// nats::MessageResult NATSClient::handleMsg() {
-//     // expected syntax:
-//     // MSG <subject> <sid> [reply-to] <#bytes>␍␊
-//     if (const auto result = core_.handleMsg(response_); result.has_value()) {
-//         return [this, result] {
-//             const auto& ok = result.value();
-//             if (std::holds_alternative<Message>(ok)) {
-//                 handleMsgPayload(std::get<Message>(ok));
-//                 doRead();
-//             } else if (std::holds_alternative<nats::MessageNeedsMoreData>(ok)) {
-//                 const auto& nmd = std::get<nats::MessageNeedsMoreData>(ok);
-//                 if (nmd.bytes.has_value()) {
-//                     net::async_read(socket_, response_, net::transfer_exactly(nmd.bytes.value()),
-//                         [this, msg=nmd.partial](const boost::system::error_code& ec, std::size_t bytes_transferred) mutable {
-//                             std::cout << "received msg of " << bytes_transferred << " bytes" << std::endl;
-//                             if (!ec) {
-//                                 handleMsgPayload(msg);
-//                                 doRead();
-//                             } else {
-//                                 onRead(ec, bytes_transferred);
-//                             }
-//                         });
-//                 } else {
-//                     // unhandled!
-//                 }
-//             } else {
-//                 // unhandled!
-//             }
-//         };
-//     } else {
-//         // unhandled!
-//     }
-//     return []{};
-// }
-
-Message NATSClient::handleMsgPayload(const Message& msg) {
-    log_(LogLevel::INFO, to_string(msg));
-    if (const auto it = handlers_.find(msg.sid); it != handlers_.end()) {
-        it->second(msg);
-        // handler should stay in the hash table until unsubscribed.
-    } else {
-        log_(LogLevel::INFO, "No handler for message with sid " + msg.sid);
+
+void NATSClient::handleMsgChunk(const nats::MessageChunk& chunk) {
+    const auto index = findSlot(chunk.sid);
+    if (index == no_slot) {
+        log_(LogLevel::INFO, "No handler for message with sid " + std::string(chunk.sid));
+    } else if (const auto* handler = std::get_if<MessageChunkHandler>(&slots_[index].handler)) {
+        deliver(index, [&] {
+            if (chunk.last()) {
+                countMessage(index);
+            }
+            (*handler)(chunk);
+        });
     }
-    return msg;
 }
 
+std::string NATSClient::newInbox() {
+    return inboxPrefix_ + std::to_string(++inboxes_);
+}
 
-void request(NATSClient& nats_client, const nats::Message& tmplt, const NATSClient::MessageHandler& handler) {
-    const auto replyInbox = "inbox";
-    const NATSClient::Subscription sub = {.subject=replyInbox, .sid = "inbox.1"};
-    nats_client.sub(sub, [&nats_client, sub, handler](const nats::Message& msg) {
-        nats_client.unsub(sub.sid);
-        return handler(msg);
-    });
+NATSClient::PubResult request(NATSClient& nats_client, const nats::Message& tmplt, NATSClient::MessageHandler handler) {
+    // each request gets its own inbox, which the server drops after the reply.
+    const auto replyInbox = nats_client.newInbox();
+    auto inbox = nats_client.sub(replyInbox, std::move(handler), {.autoUnsubscribe = 1});
     auto msg = tmplt;
     msg.replyTo = replyInbox;
-    nats_client.pub(msg);
+    auto published = nats_client.pub(msg);
+    if (published.has_value()) {
+        inbox.release();
+    }
+    // otherwise no reply can come, and the inbox ends with its handle.
+    return published;
 }
 
-void reply(NATSClient& nats_client, const std::string& subject, const NATSClient::MessageHandler& handler) {
-    nats_client.sub({.subject=subject, .sid = "1"}, [handler, &nats_client](const nats::Message& msg) {
+NATSClient::Subscription reply(NATSClient& nats_client, const std::string& subject, const NATSClient::ReplyHandler& handler) {
+    return nats_client.sub(subject, [handler, &nats_client](const nats::Message& msg) {
         auto response = handler(msg);
         if (msg.replyTo.has_value()) {
             response.subject = msg.replyTo.value();
             nats_client.pub(response);
         }
-        return response;
     });
 }
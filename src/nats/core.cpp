@@ -1,81 +1,497 @@
 #include "nats/core.h"
+#include "nats/scan.h"
 
-#include <cassert>
-#include <istream>
-#include <sstream>
+#include <algorithm>
+#include <bit>
+#include <charconv>
 #include <string>
-#include <vector>
+
+namespace {
+
+/// Exposes the get area of a std::streambuf so that it can be scanned in place.
+struct GetArea : std::streambuf {
+    static std::string_view of(std::streambuf& buf) {
+        // let the streambuf extend its get area over everything written so far,
+        // even when the get area is not empty yet.
+        (buf.*&GetArea::underflow)();
+        const char* begin = (buf.*&GetArea::gptr)();
+        const char* end = (buf.*&GetArea::egptr)();
+        return {begin, static_cast<std::size_t>(end - begin)};
+    }
+
+    static void consume(std::streambuf& buf, std::size_t n) {
+        (buf.*&GetArea::gbump)(static_cast<int>(n));
+    }
+};
+
+/// MSG and HMSG start with this byte, folded to lower case like the op names.
+bool startsMsg(char c) {
+    const auto folded = static_cast<char>(c | 0x20);
+    return folded == 'm' || folded == 'h';
+}
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t';
+}
+
+std::string_view trim(std::string_view str) {
+    while (!str.empty() && isSpace(str.front())) {
+        str.remove_prefix(1);
+    }
+    while (!str.empty() && isSpace(str.back())) {
+        str.remove_suffix(1);
+    }
+    return str;
+}
+
+} // namespace
 
 nats::MessageResult nats::Core::handleMsg(std::streambuf& buf) {
+    std::size_t consumed = 0;
+    auto result = handleMsg(GetArea::of(buf), consumed);
+    GetArea::consume(buf, consumed);
+    return result;
+}
+
+nats::MessageResult nats::Core::handleMsg(std::string_view data, std::size_t& consumed) {
+    auto result = handleMsgView(data, consumed);
+    if (!result.has_value()) {
+        return std::unexpected(std::move(result.error()));
+    }
+    if (const auto* msg = std::get_if<MessageView>(&result.value())) {
+        return msg->toMessage();
+    }
+    auto nmd = std::get<MessageNeedsMoreData>(std::move(result.value()));
+    if (nmd.bytes.has_value()) {
+        nmd.partial = header(data);
+    }
+    return nmd;
+}
+
+nats::MessageViewResult nats::Core::handleMsgView(std::string_view data, std::size_t& consumed) {
     // expected syntax:
-    // MSG <subject> <sid> [reply-to] <#bytes>␍␊
-    std::istream is(&buf);
-    std::vector<std::string> tokens;
-    {
-        std::string line;
-        if (!std::getline(is, line) || line.empty() || line.back() != '\r') {
-            return std::unexpected(Error{"malformed line"});
-        }
-
-        std::string token;
-        std::istringstream iss(line);
-        while (iss >> token) {
-            tokens.push_back(token);
-        }
-    }
-
-    if (tokens.size() < 4 || tokens[0] != "MSG") {
-        return std::unexpected{Error{"bad syntax"}};
-    }
-
-    Message msg { .subject=tokens[1], .sid=tokens[2]}; 
-    std::string bytes_as_str = "";
-    if (tokens.size() == 4) {
-        bytes_as_str = tokens[3];
-    } else if (tokens.size() == 5) {
-        msg.replyTo = tokens[3];
-        bytes_as_str = tokens[4];
-    } else {
-        return std::unexpected(nats::Error{"too many tokens"});
-    }
-    
-    std::optional<std::size_t> bytes;
-    try {
-        bytes = std::stoi(bytes_as_str);
-    } catch (...) {
-        return std::unexpected(nats::Error{"malformed bytes: " + bytes_as_str});
-    }
-        
-    msg.bytes = bytes.value();
-    size_t bytes_to_read = msg.bytes + 2;
-    if (buf.in_avail() < bytes_to_read) {
-        bytes_to_read -= buf.in_avail();
-        return MessageNeedsMoreData{ .bytes = bytes_to_read, .partial = msg };
-    }
-    return completeMsg(buf, std::move(msg));
-}
-
-nats::Message nats::Core::completeMsg(std::streambuf& buf, Message&& in) {
-    // if (buf.in_avail() < (in.bytes + 2)) {
-    //     return std::unexpected(in.bytes + 2 - buf.in_avail());
-    // }
-
-    assert(buf.in_avail() >= (in.bytes + 2));
-
-    auto msg = in;
-    std::istream is(&buf);
-    msg.payload.resize(msg.bytes);
-    is.read(msg.payload.data(), msg.bytes);
-
-    // consume the trailing CRLF (2 bytes)
-    buf.sbumpc();
-    buf.sbumpc();
-
-    // if (const auto it = handlers_.find(msg.sid); it != handlers_.end()) {
-    //     it->second(msg);
-    //     // handler should stay in the hash table until unsubscribed.
-    // } else {
-    //     log_(LogLevel::INFO, "No handler for message with sid " + msg.sid);
-    // }
+    // MSG <subject> <sid> [reply-to] <#bytes>␍␊[payload]␍␊
+    // HMSG <subject> <sid> [reply-to] <#header bytes> <#total bytes>␍␊[headers]␍␊␍␊[payload]␍␊
+    consumed = 0;
+    switch (scan(data)) {
+    case Scan::Complete:
+        if (!isMsg()) {
+            fail("bad syntax");
+            break;
+        } else {
+            const auto msg = view(data);
+            consumed = pos_;
+            reset();
+            return msg;
+        }
+    case Scan::NeedsMoreData:
+        return MessageNeedsMoreData{ .bytes = bytesNeeded_ };
+    case Scan::Failed:
+        break;
+    }
+    auto error = std::move(error_.value());
+    reset();
+    return std::unexpected(std::move(error));
+}
+
+std::expected<std::size_t, nats::Error> nats::Core::handleMsgs(std::string_view data, std::vector<MessageView>& msgs) {
+    msgs.clear();
+    std::size_t used = 0;
+    while (used < data.size()) {
+        const auto rest = data.substr(used);
+        if (state_ == State::OpStart && !startsMsg(rest.front())) {
+            break;
+        }
+        std::size_t consumed = 0;
+        auto result = handleMsgView(rest, consumed);
+        if (!result.has_value()) {
+            return std::unexpected(std::move(result.error()));
+        }
+        if (consumed == 0) {
+            break;
+        }
+        msgs.push_back(std::get<MessageView>(std::move(result.value())));
+        used += consumed;
+    }
+    return used;
+}
+
+std::expected<std::size_t, nats::Error> nats::Core::handleOps(std::string_view data, std::vector<Op>& ops) {
+    ops.clear();
+    std::size_t used = 0;
+    while (used < data.size()) {
+        const auto rest = data.substr(used);
+        if (state_ == State::Chunk || state_ == State::ChunkEnd) {
+            const auto streamed = streamChunk(rest, ops);
+            if (!streamed.has_value()) {
+                return std::unexpected(streamed.error());
+            }
+            used += streamed.value();
+            continue;
+        }
+        switch (scan(rest)) {
+        case Scan::Complete:
+            ops.push_back(op(rest));
+            used += pos_;
+            reset();
+            break;
+        case Scan::NeedsMoreData:
+            return used;
+        case Scan::Failed: {
+            auto error = std::move(error_.value());
+            reset();
+            return std::unexpected(std::move(error));
+        }
+        }
+    }
+    return used;
+}
+
+std::optional<nats::MessageView> nats::Core::partial(std::string_view data) const {
+    if (state_ != State::Payload) {
+        return std::nullopt;
+    }
+    // the payload may have started arriving, or not even the headers.
+    const auto headerEnd = std::min(data.size(), payloadBegin_ + headerSize_);
+    return MessageView{
+        .subject = arg(data, 0),
+        .sid = arg(data, 1),
+        .replyTo = replyTo(data),
+        .headers = data.substr(payloadBegin_, headerEnd - payloadBegin_),
+        .payload = data.substr(headerEnd, payloadSize_ - headerSize_)
+    };
+}
+
+std::size_t nats::Core::stream(std::string_view data, std::vector<Op>& ops) {
+    const auto begin = payloadBegin_ + headerSize_;
+    if (state_ != State::Payload || data.size() < begin) {
+        return 0;
+    }
+    stream_.subject.assign(arg(data, 0));
+    stream_.sid.assign(arg(data, 1));
+    const auto reply = replyTo(data);
+    stream_.hasReplyTo = reply.has_value();
+    stream_.replyTo.assign(reply.value_or(""));
+    stream_.headers.assign(data.substr(payloadBegin_, headerSize_));
+    stream_.size = payloadSize_ - headerSize_;
+    stream_.offset = 0;
+
+    const auto received = std::min(data.size() - begin, stream_.size);
+    ops.push_back(chunk(data.substr(begin, received)));
+    stream_.offset = received;
+    state_ = received == stream_.size ? State::ChunkEnd : State::Chunk;
+    pos_ = 0;
+    bytesNeeded_.reset();
+    return begin + received;
+}
+
+std::expected<std::size_t, nats::Error> nats::Core::streamChunk(std::string_view data, std::vector<Op>& ops) {
+    if (state_ == State::Chunk) {
+        const auto received = std::min(data.size(), stream_.size - stream_.offset);
+        ops.push_back(chunk(data.substr(0, received)));
+        stream_.offset += received;
+        if (stream_.offset == stream_.size) {
+            state_ = State::ChunkEnd;
+        }
+        return received;
+    }
+    // the trailing ␍␊ may arrive a byte at a time; pos_ counts the bytes seen.
+    std::size_t used = 0;
+    for (; pos_ < 2 && used < data.size(); ++pos_, ++used) {
+        if (data[used] != "\r\n"[pos_]) {
+            reset();
+            return std::unexpected(Error{"malformed payload"});
+        }
+    }
+    if (pos_ == 2) {
+        reset();
+    }
+    return used;
+}
+
+nats::MessageChunk nats::Core::chunk(std::string_view data) const {
+    return MessageChunk{
+        .subject = stream_.subject,
+        .sid = stream_.sid,
+        .replyTo = stream_.hasReplyTo ? std::optional<std::string_view>(stream_.replyTo) : std::nullopt,
+        .headers = stream_.headers,
+        .data = data,
+        .offset = stream_.offset,
+        .size = stream_.size
+    };
+}
+
+void nats::Core::reset() {
+    state_ = State::OpStart;
+    pos_ = 0;
+    argsBegin_ = 0;
+    lineEnd_ = 0;
+    argc_ = 0;
+    payloadBegin_ = 0;
+    headerSize_ = 0;
+    payloadSize_ = 0;
+    bytesNeeded_.reset();
+    error_.reset();
+}
+
+nats::Core::Scan nats::Core::scan(std::string_view data) {
+    while (true) {
+        switch (state_) {
+        case State::OpStart:
+            if (const auto started = startOp(data); started != Scan::Complete) {
+                return started;
+            }
+            break;
+        case State::OpHmsg:
+            if (pos_ >= data.size()) {
+                return Scan::NeedsMoreData;
+            }
+            if (!isSpace(data[pos_])) {
+                return fail("bad syntax");
+            }
+            argsBegin_ = ++pos_;
+            state_ = State::ControlLine;
+            break;
+        case State::ControlLine: {
+            // resume the search for the end of the line where the last call stopped.
+            const auto limit = kind_ == Kind::Info ? max_info_line : max_control_line;
+            const auto end = pos_ + scan::findLineEnd(data.substr(pos_));
+            if (end >= limit) {
+                return fail("maximum control line exceeded");
+            }
+            if (end == data.size()) {
+                pos_ = end;
+                return Scan::NeedsMoreData;
+            }
+            if (data[end] == '\n') {
+                return fail("malformed line");
+            }
+            if (isMsg() && !tokenize(data, argsBegin_, end)) {
+                return fail("too many tokens");
+            }
+            lineEnd_ = end;
+            pos_ = end + 1;
+            state_ = State::ControlLineLf;
+            break;
+        }
+        case State::ControlLineLf:
+            if (pos_ >= data.size()) {
+                return Scan::NeedsMoreData;
+            }
+            if (data[pos_] != '\n') {
+                return fail("malformed line");
+            }
+            ++pos_;
+            if (!isMsg()) {
+                const auto arg = data.substr(argsBegin_, lineEnd_ - argsBegin_);
+                const auto hasArg = kind_ == Kind::Info || kind_ == Kind::Err;
+                if (hasArg ? !arg.empty() && !isSpace(arg.front()) : !trim(arg).empty()) {
+                    return fail("bad syntax");
+                }
+                return Scan::Complete;
+            }
+            if (const auto parsed = parseArgs(data); !parsed.has_value()) {
+                return fail(parsed.error().what);
+            }
+            payloadBegin_ = pos_;
+            state_ = State::Payload;
+            break;
+        case State::Payload: {
+            // the payload is never scanned, only its terminator is checked.
+            const auto end = payloadBegin_ + payloadSize_;
+            if (data.size() < end + 2) {
+                bytesNeeded_ = end + 2 - data.size();
+                return Scan::NeedsMoreData;
+            }
+            if (data[end] != '\r' || data[end + 1] != '\n') {
+                return fail("malformed payload");
+            }
+            bytesNeeded_.reset();
+            pos_ = end + 2;
+            return Scan::Complete;
+        }
+        case State::Chunk:
+        case State::ChunkEnd:
+            // chunks are only delivered by handleOps().
+            return fail("message is being streamed");
+        }
+    }
+}
+
+nats::Core::Scan nats::Core::startOp(std::string_view data) {
+    if (data.size() < 4) {
+        return Scan::NeedsMoreData;
+    }
+    // the operation name and, when it is shorter, the character following it.
+    const auto word = static_cast<std::uint8_t>(data[0])
+        | static_cast<std::uint32_t>(static_cast<std::uint8_t>(data[1])) << 8
+        | static_cast<std::uint32_t>(static_cast<std::uint8_t>(data[2])) << 16
+        | static_cast<std::uint32_t>(static_cast<std::uint8_t>(data[3])) << 24;
+    pos_ = 4;
+    switch (fold(word)) {
+    case prefix("MSG "):
+    case prefix("MSG\t"):
+        kind_ = Kind::Msg;
+        break;
+    case prefix("HMSG"):
+        kind_ = Kind::Hmsg;
+        state_ = State::OpHmsg;
+        return Scan::Complete;
+    case prefix("INFO"):
+        kind_ = Kind::Info;
+        break;
+    case prefix("+OK\r"):
+        kind_ = Kind::Ok;
+        pos_ = 3;
+        break;
+    case prefix("-ERR"):
+        kind_ = Kind::Err;
+        break;
+    case prefix("PING"):
+        kind_ = Kind::Ping;
+        break;
+    case prefix("PONG"):
+        kind_ = Kind::Pong;
+        break;
+    default:
+        pos_ = 0;
+        return fail("unknown protocol operation");
+    }
+    argsBegin_ = pos_;
+    state_ = State::ControlLine;
+    return Scan::Complete;
+}
+
+bool nats::Core::tokenize(std::string_view data, std::size_t begin, std::size_t end) {
+    // walk the line in 64 byte blocks; bit i of a mask is set when the byte is
+    // a space, and bits past the end of the line count as spaces so that they
+    // close the last token.
+    argc_ = 0;
+    bool space = true;
+    for (auto block = begin; block < end; block += 64) {
+        const auto n = std::min<std::size_t>(64, end - block);
+        auto mask = scan::spaceMask(data.substr(block, n));
+        if (n < 64) {
+            mask |= ~std::uint64_t{0} << n;
+        }
+        // a token starts or ends wherever a byte differs from the previous one.
+        auto changes = mask ^ ((mask << 1) | (space ? 1 : 0));
+        while (changes) {
+            const auto bit = std::countr_zero(changes);
+            changes &= changes - 1;
+            if (mask >> bit & 1) {
+                args_[argc_ - 1].end = block + bit;
+            } else if (argc_ == max_args) {
+                return false;
+            } else {
+                args_[argc_++] = Token{block + bit, block + bit};
+            }
+        }
+        space = mask >> 63;
+    }
+    if (!space) {
+        args_[argc_ - 1].end = end;
+    }
+    return true;
+}
+
+nats::Core::Scan nats::Core::fail(std::string what) {
+    error_ = Error{std::move(what)};
+    return Scan::Failed;
+}
+
+std::expected<void, nats::Error> nats::Core::parseArgs(std::string_view data) {
+    // MSG has 3 or 4 arguments, HMSG one more for the header size.
+    const std::size_t min_args = kind_ == Kind::Hmsg ? 4 : 3;
+    if (argc_ < min_args) {
+        return std::unexpected(Error{"bad syntax"});
+    }
+    if (argc_ > min_args + 1) {
+        return std::unexpected(Error{"too many tokens"});
+    }
+    const auto size = [&](std::size_t index, std::size_t& value) -> std::expected<void, Error> {
+        const auto bytes = arg(data, index);
+        const auto last = bytes.data() + bytes.size();
+        const auto [ptr, ec] = std::from_chars(bytes.data(), last, value);
+        if (ec != std::errc{} || ptr != last) {
+            return std::unexpected(Error{"malformed bytes: " + std::string(bytes)});
+        }
+        return {};
+    };
+    headerSize_ = 0;
+    if (kind_ == Kind::Hmsg) {
+        if (auto parsed = size(argc_ - 2, headerSize_); !parsed.has_value()) {
+            return parsed;
+        }
+    }
+    if (auto parsed = size(argc_ - 1, payloadSize_); !parsed.has_value()) {
+        return parsed;
+    }
+    if (headerSize_ > payloadSize_) {
+        return std::unexpected(Error{"header size exceeds total size"});
+    }
+    if (maxPayload_ > 0 && payloadSize_ > maxPayload_) {
+        return std::unexpected(Error{"message exceeds max_payload of " + std::to_string(maxPayload_)});
+    }
+    return {};
+}
+
+std::string_view nats::Core::arg(std::string_view data, std::size_t index) const {
+    const auto& token = args_[index];
+    return data.substr(token.begin, token.end - token.begin);
+}
+
+std::optional<std::string_view> nats::Core::replyTo(std::string_view data) const {
+    // the reply subject is present when the optional argument is.
+    const std::size_t with_reply = kind_ == Kind::Hmsg ? 5 : 4;
+    if (argc_ == with_reply) {
+        return arg(data, 2);
+    }
+    return std::nullopt;
+}
+
+std::string_view nats::Core::lineArg(std::string_view data) const {
+    return trim(data.substr(argsBegin_, lineEnd_ - argsBegin_));
+}
+
+nats::Message nats::Core::header(std::string_view data) const {
+    Message msg{ .subject = std::string(arg(data, 0)), .sid = std::string(arg(data, 1)), .bytes = payloadSize_ };
+    if (const auto reply = replyTo(data); reply.has_value()) {
+        msg.replyTo.emplace(*reply);
+    }
     return msg;
-}
\ No newline at end of file
+}
+
+nats::MessageView nats::Core::view(std::string_view data) const {
+    return MessageView{
+        .subject = arg(data, 0),
+        .sid = arg(data, 1),
+        .replyTo = replyTo(data),
+        .headers = data.substr(payloadBegin_, headerSize_),
+        .payload = data.substr(payloadBegin_ + headerSize_, payloadSize_ - headerSize_)
+    };
+}
+
+nats::Op nats::Core::op(std::string_view data) const {
+    switch (kind_) {
+    case Kind::Msg:
+    case Kind::Hmsg:
+        return view(data);
+    case Kind::Info:
+        return Info{lineArg(data)};
+    case Kind::Ok:
+        return Ok{};
+    case Kind::Err: {
+        auto message = lineArg(data);
+        if (message.size() >= 2 && message.front() == '\'' && message.back() == '\'') {
+            message = message.substr(1, message.size() - 2);
+        }
+        return Err{message};
+    }
+    case Kind::Ping:
+        return Ping{};
+    case Kind::Pong:
+        return Pong{};
+    }
+    return Ok{};
+}
@@ -0,0 +1,123 @@
+#include "nats/headers.h"
+#include "nats/scan.h"
+
+#include <charconv>
+
+namespace {
+
+constexpr std::string_view version = "NATS/1.0";
+constexpr std::string_view crlf = "\r\n";
+
+std::string_view trim(std::string_view str) {
+    while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) {
+        str.remove_prefix(1);
+    }
+    while (!str.empty() && (str.back() == ' ' || str.back() == '\t')) {
+        str.remove_suffix(1);
+    }
+    return str;
+}
+
+} // namespace
+
+std::expected<nats::HeaderView, nats::Error> nats::HeaderView::parse(std::string_view block) {
+    HeaderView headers;
+    if (block.empty()) {
+        return headers;
+    }
+    if (!block.starts_with(version)) {
+        return std::unexpected(Error{"missing header version"});
+    }
+
+    std::size_t pos = 0;
+    const auto nextLine = [&]() -> std::optional<std::string_view> {
+        const auto rest = block.substr(pos);
+        const auto end = scan::findLineEnd(rest);
+        if (!rest.substr(end).starts_with(crlf)) {
+            return std::nullopt;
+        }
+        pos += end + crlf.size();
+        return rest.substr(0, end);
+    };
+
+    // NATS/1.0[ <status>[ <description>]]
+    const auto line = nextLine();
+    if (!line.has_value()) {
+        return std::unexpected(Error{"malformed header line"});
+    }
+    if (const auto status = trim(line->substr(version.size())); !status.empty()) {
+        const auto last = status.data() + status.size();
+        const auto [ptr, ec] = std::from_chars(status.data(), last, headers.status_);
+        if (ec != std::errc{} || (ptr != last && *ptr != ' ' && *ptr != '\t')) {
+            return std::unexpected(Error{"malformed header status"});
+        }
+        headers.description_ = trim(std::string_view(ptr, last - ptr));
+    }
+
+    // <key>: <value> until the empty line
+    while (true) {
+        const auto field = nextLine();
+        if (!field.has_value()) {
+            return std::unexpected(Error{"malformed header line"});
+        }
+        if (field->empty()) {
+            break;
+        }
+        const auto colon = field->find(':');
+        if (colon == 0 || colon == std::string_view::npos) {
+            return std::unexpected(Error{"malformed header field"});
+        }
+        headers.fields_.push_back(Field{field->substr(0, colon), trim(field->substr(colon + 1))});
+    }
+    return headers;
+}
+
+std::optional<std::string_view> nats::HeaderView::get(std::string_view key) const {
+    for (const auto& field : fields_) {
+        if (field.key == key) {
+            return field.value;
+        }
+    }
+    return std::nullopt;
+}
+
+nats::HeaderBuilder& nats::HeaderBuilder::status(int code, std::string_view description) {
+    char digits[16];
+    const auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), code);
+    // replace whatever follows the version on the first line.
+    const auto lineEnd = block_.find(crlf);
+    block_.erase(version.size(), lineEnd - version.size());
+    auto at = version.size();
+    block_.insert(at++, 1, ' ');
+    block_.insert(at, digits, end - digits);
+    at += end - digits;
+    if (!description.empty()) {
+        valid_ = valid_ && description.find_first_of(crlf) == std::string_view::npos;
+        block_.insert(at++, 1, ' ');
+        block_.insert(at, description);
+    }
+    return *this;
+}
+
+nats::HeaderBuilder& nats::HeaderBuilder::add(std::string_view key, std::string_view value) {
+    if (key.empty() || key.find_first_of(": \t\r\n") != std::string_view::npos
+            || value.find_first_of(crlf) != std::string_view::npos) {
+        valid_ = false;
+        return *this;
+    }
+    // the new field goes before the terminating empty line.
+    block_.resize(block_.size() - crlf.size());
+    block_.append(key);
+    block_.append(": ");
+    block_.append(value);
+    block_.append(crlf);
+    block_.append(crlf);
+    return *this;
+}
+
+void nats::HeaderBuilder::clear() {
+    block_.assign(version);
+    block_.append(crlf);
+    block_.append(crlf);
+    valid_ = true;
+}
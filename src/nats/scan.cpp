@@ -0,0 +1,208 @@
+#include "nats/scan.h"
+
+#include <algorithm>
+#include <bit>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define NATS_SCAN_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define NATS_SCAN_NEON 1
+#endif
+
+namespace {
+
+std::size_t findLineEndScalar(const char* data, std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) {
+        if (data[i] == '\r' || data[i] == '\n') {
+            return i;
+        }
+    }
+    return size;
+}
+
+std::uint64_t spaceMaskScalar(const char* data, std::size_t size) {
+    std::uint64_t mask = 0;
+    const auto n = std::min<std::size_t>(size, 64);
+    for (std::size_t i = 0; i < n; ++i) {
+        if (data[i] == ' ' || data[i] == '\t') {
+            mask |= std::uint64_t{1} << i;
+        }
+    }
+    return mask;
+}
+
+#if defined(NATS_SCAN_X86)
+
+std::uint32_t lineEnds16(const char* data) {
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    const auto hits = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(hits));
+}
+
+std::uint64_t spaces16(const char* data) {
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    const auto hits = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(hits));
+}
+
+std::size_t findLineEndSse2(const char* data, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        const std::uint64_t mask = lineEnds16(data + i)
+            | std::uint64_t{lineEnds16(data + i + 16)} << 16
+            | std::uint64_t{lineEnds16(data + i + 32)} << 32
+            | std::uint64_t{lineEnds16(data + i + 48)} << 48;
+        if (mask) {
+            return i + std::countr_zero(mask);
+        }
+    }
+    for (; i + 16 <= size; i += 16) {
+        if (const auto mask = lineEnds16(data + i)) {
+            return i + std::countr_zero(mask);
+        }
+    }
+    return i + findLineEndScalar(data + i, size - i);
+}
+
+std::uint64_t spaceMaskSse2(const char* data, std::size_t size) {
+    if (size < 64) {
+        return spaceMaskScalar(data, size);
+    }
+    return spaces16(data)
+        | spaces16(data + 16) << 16
+        | spaces16(data + 32) << 32
+        | spaces16(data + 48) << 48;
+}
+
+__attribute__((target("avx2")))
+std::uint64_t lineEnds32(const char* data) {
+    const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+    const auto hits = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+    return static_cast<std::uint32_t>(_mm256_movemask_epi8(hits));
+}
+
+__attribute__((target("avx2")))
+std::uint64_t spaces32(const char* data) {
+    const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+    const auto hits = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+    return static_cast<std::uint32_t>(_mm256_movemask_epi8(hits));
+}
+
+__attribute__((target("avx2")))
+std::size_t findLineEndAvx2(const char* data, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        const auto mask = lineEnds32(data + i) | lineEnds32(data + i + 32) << 32;
+        if (mask) {
+            return i + std::countr_zero(mask);
+        }
+    }
+    for (; i + 16 <= size; i += 16) {
+        if (const auto mask = lineEnds16(data + i)) {
+            return i + std::countr_zero(mask);
+        }
+    }
+    return i + findLineEndScalar(data + i, size - i);
+}
+
+__attribute__((target("avx2")))
+std::uint64_t spaceMaskAvx2(const char* data, std::size_t size) {
+    if (size < 64) {
+        return spaceMaskScalar(data, size);
+    }
+    return spaces32(data) | spaces32(data + 32) << 32;
+}
+
+#elif defined(NATS_SCAN_NEON)
+
+/// one bit per byte of a comparison result, like _mm_movemask_epi8.
+std::uint64_t movemask16(uint8x16_t hits) {
+    static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const auto bits = vandq_u8(hits, vld1q_u8(weights));
+    return vaddv_u8(vget_low_u8(bits)) | std::uint64_t{vaddv_u8(vget_high_u8(bits))} << 8;
+}
+
+std::uint64_t lineEnds16(const char* data) {
+    const auto v = vld1q_u8(reinterpret_cast<const uint8_t*>(data));
+    return movemask16(vorrq_u8(vceqq_u8(v, vdupq_n_u8('\r')), vceqq_u8(v, vdupq_n_u8('\n'))));
+}
+
+std::uint64_t spaces16(const char* data) {
+    const auto v = vld1q_u8(reinterpret_cast<const uint8_t*>(data));
+    return movemask16(vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('\t'))));
+}
+
+std::size_t findLineEndNeon(const char* data, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        const auto mask = lineEnds16(data + i)
+            | lineEnds16(data + i + 16) << 16
+            | lineEnds16(data + i + 32) << 32
+            | lineEnds16(data + i + 48) << 48;
+        if (mask) {
+            return i + std::countr_zero(mask);
+        }
+    }
+    return i + findLineEndScalar(data + i, size - i);
+}
+
+std::uint64_t spaceMaskNeon(const char* data, std::size_t size) {
+    if (size < 64) {
+        return spaceMaskScalar(data, size);
+    }
+    return spaces16(data)
+        | spaces16(data + 16) << 16
+        | spaces16(data + 32) << 32
+        | spaces16(data + 48) << 48;
+}
+
+#endif
+
+std::vector<nats::scan::Implementation> detect() {
+    std::vector<nats::scan::Implementation> found;
+#if defined(NATS_SCAN_X86)
+    if (__builtin_cpu_supports("avx2")) {
+        found.push_back({"avx2", findLineEndAvx2, spaceMaskAvx2});
+    }
+    found.push_back({"sse2", findLineEndSse2, spaceMaskSse2});
+#elif defined(NATS_SCAN_NEON)
+    found.push_back({"neon", findLineEndNeon, spaceMaskNeon});
+#endif
+    found.push_back({"scalar", findLineEndScalar, spaceMaskScalar});
+    return found;
+}
+
+const std::vector<nats::scan::Implementation>& implementations() {
+    static const auto found = detect();
+    return found;
+}
+
+const nats::scan::Implementation*& selected() {
+    static const nats::scan::Implementation* impl = &implementations().front();
+    return impl;
+}
+
+} // namespace
+
+std::span<const nats::scan::Implementation> nats::scan::supported() {
+    return implementations();
+}
+
+const nats::scan::Implementation& nats::scan::active() {
+    return *selected();
+}
+
+bool nats::scan::select(std::string_view name) {
+    const auto& found = implementations();
+    const auto it = std::find_if(found.begin(), found.end(), [name](const Implementation& impl) {
+        return impl.name == name;
+    });
+    if (it == found.end()) {
+        return false;
+    }
+    selected() = &*it;
+    return true;
+}
@@ -0,0 +1,174 @@
+#include "nats/subject_trie.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+constexpr auto npos = std::string_view::npos;
+
+/// lets children be found with the string_view token of a subject.
+struct TokenHash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view token) const { return std::hash<std::string_view>{}(token); }
+};
+
+/// the token starting at `pos` and the start of the next one, npos after the last.
+std::pair<std::string_view, std::size_t> token(std::string_view subject, std::size_t pos) {
+    const auto dot = subject.find('.', pos);
+    if (dot == npos) {
+        return {subject.substr(pos), npos};
+    }
+    return {subject.substr(pos, dot - pos), dot + 1};
+}
+
+bool eraseId(std::vector<nats::SubjectTrie::Id>& ids, nats::SubjectTrie::Id id) {
+    const auto it = std::ranges::find(ids, id);
+    if (it == ids.end()) {
+        return false;
+    }
+    *it = ids.back();
+    ids.pop_back();
+    return true;
+}
+
+} // namespace
+
+struct nats::SubjectTrie::Node {
+    std::unordered_map<std::string, std::unique_ptr<Node>, TokenHash, std::equal_to<>> literals;
+    std::unique_ptr<Node> star;
+    /// ids of the patterns ending here, and of those ending here in `>`.
+    std::vector<Id> ids;
+    std::vector<Id> rest;
+
+    bool empty() const {
+        return literals.empty() && !star && ids.empty() && rest.empty();
+    }
+
+    /// collect the matches of the subject from `pos` on, npos once all of it is matched.
+    void match(std::string_view subject, std::size_t pos, std::vector<Id>& matched) const {
+        if (pos == npos) {
+            matched.insert(matched.end(), ids.begin(), ids.end());
+            return;
+        }
+        // at least one token is left for `>`.
+        matched.insert(matched.end(), rest.begin(), rest.end());
+        const auto [literal, next] = token(subject, pos);
+        if (const auto it = literals.find(literal); it != literals.end()) {
+            it->second->match(subject, next, matched);
+        }
+        if (star) {
+            star->match(subject, next, matched);
+        }
+    }
+};
+
+nats::SubjectTrie::SubjectTrie() : root_(std::make_unique<Node>()) {}
+
+nats::SubjectTrie::~SubjectTrie() = default;
+
+bool nats::SubjectTrie::validPattern(std::string_view pattern) {
+    if (pattern.empty()) {
+        return false;
+    }
+    for (std::size_t pos = 0; pos != npos;) {
+        const auto [literal, next] = token(pattern, pos);
+        if (literal.empty() || literal.find_first_of(" \t\r\n") != npos) {
+            return false;
+        }
+        if (literal.size() > 1 && literal.find_first_of("*>") != npos) {
+            return false;
+        }
+        if (literal == ">" && next != npos) {
+            return false;
+        }
+        pos = next;
+    }
+    return true;
+}
+
+bool nats::SubjectTrie::insert(std::string_view pattern, Id id) {
+    if (!validPattern(pattern)) {
+        return false;
+    }
+    auto* node = root_.get();
+    for (std::size_t pos = 0; pos != npos;) {
+        const auto [literal, next] = token(pattern, pos);
+        if (literal == ">") {
+            node->rest.push_back(id);
+            ++size_;
+            return true;
+        }
+        std::unique_ptr<Node>* child = &node->star;
+        if (literal != "*") {
+            auto it = node->literals.find(literal);
+            if (it == node->literals.end()) {
+                it = node->literals.emplace(std::string(literal), nullptr).first;
+            }
+            child = &it->second;
+        }
+        if (!*child) {
+            *child = std::make_unique<Node>();
+        }
+        node = child->get();
+        pos = next;
+    }
+    node->ids.push_back(id);
+    ++size_;
+    return true;
+}
+
+bool nats::SubjectTrie::erase(std::string_view pattern, Id id) {
+    if (!validPattern(pattern)) {
+        return false;
+    }
+    // the nodes on the way down with the token leading to the next one.
+    std::vector<std::pair<Node*, std::string_view>> path;
+    auto* node = root_.get();
+    auto erased = false;
+    for (std::size_t pos = 0; node != nullptr;) {
+        if (pos == npos) {
+            erased = eraseId(node->ids, id);
+            break;
+        }
+        const auto [literal, next] = token(pattern, pos);
+        if (literal == ">") {
+            erased = eraseId(node->rest, id);
+            break;
+        }
+        path.emplace_back(node, literal);
+        if (literal == "*") {
+            node = node->star.get();
+        } else {
+            const auto it = node->literals.find(literal);
+            node = it == node->literals.end() ? nullptr : it->second.get();
+        }
+        pos = next;
+    }
+    if (!erased) {
+        return false;
+    }
+    --size_;
+    // drop the branch that no pattern runs through any more.
+    for (auto step = path.rbegin(); step != path.rend(); ++step) {
+        auto& [parent, literal] = *step;
+        auto& child = literal == "*" ? parent->star : parent->literals.find(literal)->second;
+        if (!child->empty()) {
+            break;
+        }
+        if (literal == "*") {
+            parent->star.reset();
+        } else {
+            parent->literals.erase(parent->literals.find(literal));
+        }
+    }
+    return true;
+}
+
+void nats::SubjectTrie::match(std::string_view subject, std::vector<Id>& ids) const {
+    if (!subject.empty()) {
+        root_->match(subject, 0, ids);
+    }
+}
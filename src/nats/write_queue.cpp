@@ -0,0 +1,143 @@
+#include "nats/write_queue.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace {
+
+/// no more written blocks are kept for reuse than this.
+constexpr std::size_t max_spare_blocks = 16;
+
+/// `a` is at or before `b` for sequence numbers that wrap around.
+bool notAfter(std::uint32_t a, std::uint32_t b) {
+    return static_cast<std::int32_t>(b - a) >= 0;
+}
+
+} // namespace
+
+void nats::WriteQueue::append(std::string_view bytes) {
+    queuedBytes_ += bytes.size();
+    if (bytes.size() > coalesce_limit) {
+        largestSegment_ = std::max(largestSegment_, bytes.size());
+        queued_.push_back(Segment{.bytes = std::string(bytes)});
+        return;
+    }
+    block(bytes.size()).append(bytes);
+}
+
+void nats::WriteQueue::push(std::string bytes) {
+    if (bytes.size() <= coalesce_limit) {
+        append(bytes);
+        return;
+    }
+    queuedBytes_ += bytes.size();
+    largestSegment_ = std::max(largestSegment_, bytes.size());
+    queued_.push_back(Segment{.bytes = std::move(bytes)});
+}
+
+void nats::WriteQueue::push(SharedPayload bytes) {
+    if (bytes->size() <= coalesce_limit) {
+        append(*bytes);
+        return;
+    }
+    queuedBytes_ += bytes->size();
+    largestSegment_ = std::max(largestSegment_, bytes->size());
+    queued_.push_back(Segment{.shared = std::move(bytes)});
+}
+
+std::string& nats::WriteQueue::block(std::size_t size) {
+    // append to the last block while it has room, which never moves its bytes.
+    if (!queued_.empty() && queued_.back().block) {
+        auto& last = queued_.back().bytes;
+        if (last.size() + size <= last.capacity()) {
+            return last;
+        }
+    }
+    Segment segment{.block = true};
+    if (spare_.empty()) {
+        segment.bytes.reserve(block_size);
+    } else {
+        segment.bytes = std::move(spare_.back());
+        spare_.pop_back();
+    }
+    return queued_.emplace_back(std::move(segment)).bytes;
+}
+
+const std::vector<boost::asio::const_buffer>& nats::WriteQueue::startWrite() {
+    assert(!writing_);
+    writing_ = true;
+    std::swap(queued_, inflight_);
+    inflightBytes_ = queuedBytes_;
+    queuedBytes_ = 0;
+    largestSegment_ = 0;
+    buffers_.clear();
+    for (const auto& segment : inflight_) {
+        const auto bytes = segment.view();
+        buffers_.emplace_back(bytes.data(), bytes.size());
+    }
+    return buffers_;
+}
+
+void nats::WriteQueue::finishWrite() {
+    assert(writing_);
+    writing_ = false;
+    recycle(inflight_);
+    inflightBytes_ = 0;
+    buffers_.clear();
+}
+
+void nats::WriteQueue::finishWrite(std::uint32_t until) {
+    assert(writing_);
+    writing_ = false;
+    pinnedBytes_ += inflightBytes_;
+    pinned_.push_back(Pinned{until, std::move(inflight_), inflightBytes_});
+    inflight_.clear();
+    inflightBytes_ = 0;
+    buffers_.clear();
+    // sends that fell back to copying may leave nothing to wait for.
+    releasePinned();
+}
+
+void nats::WriteQueue::clear() {
+    recycle(queued_);
+    queuedBytes_ = 0;
+    largestSegment_ = 0;
+}
+
+void nats::WriteQueue::release(std::uint32_t first, std::uint32_t last) {
+    early_.emplace_back(first, last);
+    // notifications can arrive out of order; fold in the ranges that connect.
+    for (auto merged = true; merged;) {
+        merged = false;
+        for (auto it = early_.begin(); it != early_.end(); ++it) {
+            if (notAfter(it->first, released_)) {
+                if (notAfter(released_, it->second)) {
+                    released_ = it->second + 1;
+                }
+                early_.erase(it);
+                merged = true;
+                break;
+            }
+        }
+    }
+    releasePinned();
+}
+
+void nats::WriteQueue::releasePinned() {
+    while (!pinned_.empty() && notAfter(pinned_.front().until, released_)) {
+        pinnedBytes_ -= pinned_.front().bytes;
+        recycle(pinned_.front().segments);
+        pinned_.pop_front();
+    }
+}
+
+void nats::WriteQueue::recycle(std::vector<Segment>& segments) {
+    for (auto& segment : segments) {
+        if (segment.block && spare_.size() < max_spare_blocks) {
+            segment.bytes.clear();
+            spare_.push_back(std::move(segment.bytes));
+        }
+    }
+    segments.clear();
+}
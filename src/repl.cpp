@@ -74,31 +74,54 @@ bool REPL::evaluate(std::istream &is) {
             stop_reading = true;
         } else if (input == "sub") {
             const auto subject = tokens.size() > 1 ? tokens[1] : "foo";
-            nats_client_.sub({.subject=subject, .sid="1"}, [](const nats::Message& msg) {
+            subscription_ = nats_client_.sub(subject, [](const nats::MessageView& msg) {
                 std::cout << "Received message: " << msg.payload << std::endl;
-                return nats::Message{};
             });
         } else if (input == "unsub") {
-            nats_client_.unsub("1");
+            subscription_.unsubscribe();
         } else if (input == "pub") {
-            nats_client_.pub({
+            const auto result = nats_client_.pub({
                 .subject=tokens.size() > 1 ? tokens[1] : "foo", 
                 .payload=tokens.size() > 2 ? tokens[2] : "hello"
             });
+            if (!result.has_value()) {
+                print(LogLevel::ERROR, "pub failed: " + result.error().message);
+            }
         } else if (input == "hpub") {
-            const auto subject = tokens.size() > 1 ? tokens[1] : "foo";
-            nats_client_.hpub(subject);
+            // hpub <subject> <payload> [key:value]...
+            nats::HeaderBuilder headers;
+            for (std::size_t i = 3; i < tokens.size(); ++i) {
+                const auto colon = tokens[i].find(':');
+                headers.add(tokens[i].substr(0, colon), colon == std::string::npos ? "" : tokens[i].substr(colon + 1));
+            }
+            const auto result = nats_client_.hpub({
+                .subject=tokens.size() > 1 ? tokens[1] : "foo",
+                .payload=tokens.size() > 2 ? tokens[2] : "hello"
+            }, headers);
+            if (!result.has_value()) {
+                print(LogLevel::ERROR, "hpub failed: " + result.error().message);
+            }
+        } else if (input == "flush") {
+            nats_client_.flush([this](const boost::system::error_code& ec) {
+                if (ec) {
+                    print(LogLevel::ERROR, "flush failed: " + ec.message());
+                } else {
+                    print(LogLevel::INFO, "flushed");
+                }
+            });
         } else if (input == "request") {
             const auto logger = [this](LogLevel level, const std::string& msg) {
                 print(level, msg);
             };
-            request(nats_client_, {
+            const auto result = request(nats_client_, {
                 .subject=tokens.size() > 1 ? tokens[1] : "foo",
                 .payload=tokens.size() > 2 ? tokens[2] : "hello"},
                 [logger](const nats::Message& msg) {
                     logger(LogLevel::INFO, "Received reply: " + msg.payload);
-                    return nats::Message{};
             });
+            if (!result.has_value()) {
+                print(LogLevel::ERROR, "request failed: " + result.error().message);
+            }
         } else if (input == "reply") {
             const auto subject = tokens.size() > 1 ? tokens[1] : "foo";
             const auto payload = tokens.size() > 2 ? tokens[2] : "hello";
@@ -106,10 +129,10 @@ bool REPL::evaluate(std::istream &is) {
             const auto logger = [this](LogLevel level, const std::string& msg) {
                 print(level, msg);
             };
-            reply(nats_client_, subject, [payload, logger](const nats::Message& msg) {
+            replies_.push_back(reply(nats_client_, subject, [payload, logger](const nats::Message& msg) {
                 logger(LogLevel::INFO, "Received request: " + msg.payload);
                 return nats::Message{.payload = payload};
-            });
+            }));
         } else {
             std::cerr << "Unknown command: " << input << std::endl;
         }
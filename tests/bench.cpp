@@ -0,0 +1,110 @@
+#include "bench.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+std::atomic<std::uint64_t> allocated{0};
+std::atomic<std::uint64_t> sent{0};
+int failures = 0;
+
+struct Entry {
+    const char* name;
+    bench::Case fn;
+};
+
+std::vector<Entry>& registry() {
+    static std::vector<Entry> entries;
+    return entries;
+}
+
+} // namespace
+
+// count every allocation so benchmarks can report allocations per item.
+void* operator new(std::size_t size) {
+    allocated.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+std::uint64_t bench::allocations() {
+    return allocated.load(std::memory_order_relaxed);
+}
+
+// count the socket writes made through asio, which sends with sendmsg and send.
+extern "C" ssize_t sendmsg(int fd, const struct msghdr* msg, int flags) {
+    sent.fetch_add(1, std::memory_order_relaxed);
+    return ::syscall(SYS_sendmsg, fd, msg, flags);
+}
+
+extern "C" ssize_t send(int fd, const void* buf, std::size_t len, int flags) {
+    sent.fetch_add(1, std::memory_order_relaxed);
+    return ::syscall(SYS_sendto, fd, buf, len, flags, nullptr, 0);
+}
+
+std::uint64_t bench::sendCalls() {
+    return sent.load(std::memory_order_relaxed);
+}
+
+int bench::add(const char* name, Case fn) {
+    registry().push_back({name, fn});
+    return static_cast<int>(registry().size());
+}
+
+void bench::State::report(const std::string& label, std::chrono::nanoseconds elapsed, std::uint64_t items, std::uint64_t bytes) {
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    std::printf("%-32s %-36s %12.1f ns/item %14.0f items/s %10.1f MB/s",
+        name_.c_str(), label.c_str(),
+        items ? elapsed.count() / static_cast<double>(items) : 0.0,
+        items / seconds, bytes / seconds / 1e6);
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+void bench::State::counter(const std::string& name, double value) {
+    std::printf("%-32s   %s = %.3f\n", "", name.c_str(), value);
+    std::fflush(stdout);
+}
+
+void bench::State::check(bool holds, const std::string& what) {
+    if (!holds) {
+        std::printf("%-32s   FAILED: %s\n", "", what.c_str());
+        std::fflush(stdout);
+        ++failures;
+    }
+}
+
+/// usage: benchmarks [substring]
+/// runs every registered case whose name contains the substring.
+int main(int argc, char* argv[]) {
+#ifndef __OPTIMIZE__
+    std::printf("warning: benchmarks built without optimization\n");
+#endif
+    const std::string_view filter = argc > 1 ? argv[1] : "";
+    for (const auto& entry : registry()) {
+        if (std::string_view(entry.name).find(filter) != std::string_view::npos) {
+            bench::State state(entry.name);
+            entry.fn(state);
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
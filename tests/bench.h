@@ -0,0 +1,78 @@
+#ifndef NATS_BENCH_H
+#define NATS_BENCH_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace bench {
+
+/// Collects the measurements of one benchmark case.
+class State {
+public:
+    explicit State(std::string name) : name_(std::move(name)) {}
+
+    /// @brief  Time a function
+    ///
+    /// Calls fn repeatedly until the minimum run time has elapsed and reports
+    /// the rate, each call processing the given number of items and bytes.
+    /// @return The number of calls made.
+    template <typename Fn>
+    std::uint64_t run(const std::string& label, std::uint64_t items, std::uint64_t bytes, Fn&& fn) {
+        using clock = std::chrono::steady_clock;
+        std::uint64_t iterations = 0;
+        const auto start = clock::now();
+        auto elapsed = clock::duration{};
+        do {
+            for (int i = 0; i < 16; ++i) {
+                fn();
+            }
+            iterations += 16;
+            elapsed = clock::now() - start;
+        } while (elapsed < min_time);
+        report(label, elapsed, iterations * items, iterations * bytes);
+        return iterations;
+    }
+
+    /// record a measurement that the benchmark timed itself.
+    void report(const std::string& label, std::chrono::nanoseconds elapsed, std::uint64_t items, std::uint64_t bytes);
+
+    /// print a named value (e.g. syscalls/msg) for the last measurement.
+    void counter(const std::string& name, double value);
+
+    /// @brief  Fail the run unless a property of the last measurement holds
+    ///
+    /// The benchmarks go on, but the process exits with a non-zero status.
+    void check(bool holds, const std::string& what);
+
+    static constexpr std::chrono::milliseconds min_time{500};
+
+private:
+    std::string name_;
+};
+
+typedef void (*Case)(State&);
+
+/// registers a benchmark case; used through NATS_BENCHMARK.
+int add(const char* name, Case fn);
+
+/// number of heap allocations made by the process so far.
+std::uint64_t allocations();
+
+/// number of socket send system calls made by the process so far.
+std::uint64_t sendCalls();
+
+/// keeps the compiler from optimizing away a computed value.
+template <typename T>
+inline void doNotOptimize(T const& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+} // namespace bench
+
+#define NATS_BENCHMARK(fn, name) \
+    static void fn(bench::State&); \
+    static const int fn##_registered = bench::add(name, fn); \
+    static void fn(bench::State& state)
+
+#endif // NATS_BENCH_H
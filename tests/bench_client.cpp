@@ -0,0 +1,686 @@
+#include "bench.h"
+#include "nats/client.h"
+#include "nats/write_queue.h"
+#include "stub_server.h"
+
+#include <atomic>
+#include <ctime>
+#include <thread>
+
+namespace {
+
+/// a client connected to a stub server running on its own thread.
+struct Connection {
+    explicit Connection(const NATSOptions& options = {}) : client(io, "127.0.0.1", server.port(), options) {
+        client.setLogging([](LogLevel, const std::string&) {});
+    }
+
+    /// start the client and run the server side on a thread once it has connected.
+    template <typename ServerSide>
+    void start(ServerSide&& serverSide) {
+        std::atomic<bool> connected = false;
+        thread = std::thread([this, &connected, serverSide] {
+            server.accept();
+            server.readUntil("CONNECT");
+            connected = true;
+            serverSide(server);
+        });
+        client.start();
+        runUntil([&] { return connected.load(); });
+    }
+
+    /// the condition may be set by the server thread, which does not wake the io_context.
+    template <typename Condition>
+    void runUntil(Condition&& condition) {
+        while (!condition()) {
+            io.restart();
+            io.run_one_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    ~Connection() {
+        client.shutdown();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client;
+    std::thread thread;
+};
+
+/// cpu time used by the calling thread.
+std::chrono::nanoseconds threadCpuTime() {
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+} // namespace
+
+NATS_BENCHMARK(clientReceive, "client/receive 100B") {
+    constexpr std::size_t count = 1'000'000;
+    const std::string frame = "MSG bench.subject 1 100\r\n" + std::string(100, 'x') + "\r\n";
+    std::string block;
+    for (std::size_t i = 0; i < 400; ++i) {
+        block += frame;
+    }
+
+    Connection conn;
+    conn.start([&](StubServer& server) {
+        server.readUntil("SUB bench.subject 1\r\n");
+        for (std::size_t sent = 0; sent < count; sent += 400) {
+            server.write(block);
+        }
+        server.drain();
+    });
+
+    std::size_t received = 0;
+    const auto before = bench::allocations();
+    const auto start = std::chrono::steady_clock::now();
+    const auto subscription = conn.client.sub("bench.subject", [&](const nats::MessageView& msg) {
+        ++received;
+    });
+    conn.runUntil([&] { return received == count; });
+    state.report("MessageView handler", std::chrono::steady_clock::now() - start, count, count * frame.size());
+    // what is left are the slabs the reads go to, a few per thousand messages.
+    const auto allocs = double(bench::allocations() - before) / double(count);
+    state.counter("allocs/msg", allocs);
+    state.check(allocs < 0.01, "a delivery allocates");
+}
+
+NATS_BENCHMARK(clientReceiveSids, "client/receive across subscriptions") {
+    // each message goes to the next of `subs` subscriptions, so the lookup of
+    // the handler by sid is not served from one hot entry.
+    constexpr std::size_t count = 1'000'000;
+    for (const std::size_t subs : {1u, 1'000u, 100'000u}) {
+        std::string block;
+        for (std::size_t i = 0; i < 1000; ++i) {
+            block += "MSG bench.sids " + std::to_string(i % subs + 1) + " 16\r\n" + std::string(16, 'x') + "\r\n";
+        }
+
+        Connection conn;
+        conn.start([&](StubServer& server) {
+            server.readUntil("SUB bench.sids " + std::to_string(subs) + "\r\n");
+            for (std::size_t sent = 0; sent < count; sent += 1000) {
+                server.write(block);
+            }
+            server.drain();
+        });
+
+        std::size_t received = 0;
+        std::vector<NATSClient::Subscription> subscriptions;
+        for (std::size_t i = 0; i < subs; ++i) {
+            subscriptions.push_back(conn.client.sub("bench.sids", [&](const nats::MessageView& msg) {
+                ++received;
+            }));
+        }
+        const auto start = std::chrono::steady_clock::now();
+        conn.runUntil([&] { return received == count; });
+        state.report(std::to_string(subs) + " sids", std::chrono::steady_clock::now() - start, count, count * (block.size() / 1000));
+        subscriptions.clear();
+    }
+}
+
+NATS_BENCHMARK(clientReceiveQueued, "client/receive to slow handlers") {
+    // four subscriptions whose handlers each spend about half a microsecond.
+    constexpr std::size_t count = 400'000;
+    constexpr std::size_t subs = 4;
+    std::string block;
+    for (std::size_t i = 0; i < 400; ++i) {
+        block += "MSG bench.slow " + std::to_string(i % subs + 1) + " 100\r\n" + std::string(100, 'x') + "\r\n";
+    }
+    const auto work = [] {
+        const auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(500);
+        while (std::chrono::steady_clock::now() < until) {
+        }
+    };
+
+    const auto receive = [&](const std::string& label, std::size_t workers, std::size_t pendingMsgs) {
+        Connection conn({.workers = workers});
+        conn.start([&](StubServer& server) {
+            server.readUntil("SUB bench.slow " + std::to_string(subs) + "\r\n");
+            for (std::size_t sent = 0; sent < count; sent += 400) {
+                server.write(block);
+            }
+            server.drain();
+        });
+
+        std::atomic<std::size_t> received = 0;
+        std::vector<NATSClient::Subscription> subscriptions;
+        for (std::size_t i = 0; i < subs; ++i) {
+            subscriptions.push_back(conn.client.sub("bench.slow", [&](const nats::MessageView& msg) {
+                work();
+                ++received;
+            }, {.pendingMsgs = pendingMsgs}));
+        }
+        const auto cpu = threadCpuTime();
+        const auto start = std::chrono::steady_clock::now();
+        conn.runUntil([&] { return received == count; });
+        state.report(label, std::chrono::steady_clock::now() - start, count, count * (block.size() / 400));
+        state.counter("IO thread cpu ns/msg", double((threadCpuTime() - cpu).count()) / double(count));
+        subscriptions.clear();
+    };
+
+    receive("inline on the IO thread", 1, 0);
+    // queues large enough that nothing is dropped.
+    receive("queued, 1 worker", 1, count);
+    receive("queued, 4 workers", 4, count);
+}
+
+NATS_BENCHMARK(clientReceivePartitioned, "client/partitioned dispatch") {
+    // one wildcard subscription over 64 subjects, its handler spending about
+    // half a microsecond, split into as many partitions as there are workers.
+    constexpr std::size_t count = 400'000;
+    constexpr std::size_t subjects = 64;
+    std::string block;
+    for (std::size_t i = 0; i < 400; ++i) {
+        block += "MSG bench.part." + std::to_string(i % subjects) + " 1 100\r\n" + std::string(100, 'x') + "\r\n";
+    }
+    const auto work = [] {
+        const auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(500);
+        while (std::chrono::steady_clock::now() < until) {
+        }
+    };
+
+    for (const std::size_t workers : {1, 2, 4, 8}) {
+        Connection conn({.workers = workers});
+        conn.start([&](StubServer& server) {
+            server.readUntil("SUB bench.part.* 1\r\n");
+            for (std::size_t sent = 0; sent < count; sent += 400) {
+                server.write(block);
+            }
+            server.drain();
+        });
+
+        std::atomic<std::size_t> received = 0;
+        // the limits are shared out between the partitions, which the subjects
+        // do not hash to evenly, so with room to spare for nothing to be dropped.
+        const auto subscription = conn.client.sub("bench.part.*", [&](const nats::MessageView& msg) {
+            work();
+            ++received;
+        }, {.pendingMsgs = 2 * count, .partitions = workers});
+        const auto start = std::chrono::steady_clock::now();
+        conn.runUntil([&] { return received == count; });
+        state.report(std::to_string(workers) + (workers == 1 ? " worker" : " workers"), std::chrono::steady_clock::now() - start, count, count * (block.size() / 400));
+        state.check(subscription.dropped() == 0, "messages were dropped");
+    }
+}
+
+NATS_BENCHMARK(clientReceiveLarge, "client/receive large payloads") {
+    // up to the max_payload a server is usually configured with.
+    for (const std::size_t size : {1u << 20, 2u << 20, 4u << 20, 8u << 20}) {
+        const std::size_t count = (256u << 20) / size;
+        const std::string frame = "MSG bench.large 1 " + std::to_string(size) + "\r\n" + std::string(size, 'x') + "\r\n";
+
+        const auto receive = [&](const std::string& label, auto handler) {
+            Connection conn;
+            conn.start([&](StubServer& server) {
+                server.readUntil("SUB bench.large 1\r\n");
+                for (std::size_t sent = 0; sent < count; ++sent) {
+                    server.write(frame);
+                }
+                server.drain();
+            });
+
+            std::size_t received = 0;
+            const auto before = bench::allocations();
+            const auto start = std::chrono::steady_clock::now();
+            const auto subscription = conn.client.sub("bench.large", handler(received));
+            conn.runUntil([&] { return received == count; });
+            state.report(std::to_string(size >> 20) + "MB " + label, std::chrono::steady_clock::now() - start, count, count * frame.size());
+            state.counter("allocs/msg", double(bench::allocations() - before) / double(count));
+        };
+
+        receive("MessageView handler", [](std::size_t& received) {
+            return NATSClient::MessageViewHandler([&received](const nats::MessageView& msg) {
+                bench::doNotOptimize(msg.payload.data());
+                ++received;
+            });
+        });
+        receive("MessageChunk handler", [](std::size_t& received) {
+            return NATSClient::MessageChunkHandler([&received](const nats::MessageChunk& chunk) {
+                bench::doNotOptimize(chunk.data.data());
+                received += chunk.last();
+            });
+        });
+    }
+}
+
+NATS_BENCHMARK(clientIngest, "client/ingest 1GB/s") {
+    // the server writes 1KB messages paced to 1GB/s for about a second; the
+    // client thread's cpu time shows what the receive buffer costs.
+    constexpr double rate = 1e9;
+    const std::string frame = "MSG bench.ingest 1 1000\r\n" + std::string(1000, 'x') + "\r\n";
+    std::string block;
+    while (block.size() + frame.size() <= 64 * 1024) {
+        block += frame;
+    }
+    const std::size_t perBlock = block.size() / frame.size();
+    const std::size_t blocks = std::size_t(rate) / block.size();
+
+    const auto ingest = [&](const std::string& label, const NATSOptions& options) {
+        Connection conn(options);
+        conn.start([&](StubServer& server) {
+            server.readUntil("SUB bench.ingest 1\r\n");
+            const auto start = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < blocks; ++i) {
+                std::this_thread::sleep_until(start + std::chrono::nanoseconds(std::int64_t(double(i * block.size()) / rate * 1e9)));
+                server.write(block);
+            }
+            server.drain();
+        });
+
+        std::size_t received = 0;
+        const auto cpu = threadCpuTime();
+        const auto start = std::chrono::steady_clock::now();
+        const auto subscription = conn.client.sub("bench.ingest", [&](const nats::MessageView& msg) {
+            bench::doNotOptimize(msg.payload.data());
+            ++received;
+        });
+        conn.runUntil([&] { return received == blocks * perBlock; });
+        state.report(label, std::chrono::steady_clock::now() - start, received, received * frame.size());
+        state.counter("cpu ns/msg", double((threadCpuTime() - cpu).count()) / double(received));
+    };
+
+    ingest("slab buffer", {});
+    ingest("ring buffer", {.receiveBuffer = NATSOptions::ReceiveBuffer::Ring});
+}
+
+NATS_BENCHMARK(clientPublish, "client/publish 100B") {
+    constexpr std::size_t count = 1'000'000;
+    const std::string payload(100, 'x');
+    const std::string frame = "PUB bench.subject " + std::to_string(payload.size()) + "\r\n" + payload + "\r\n";
+
+    {
+        // what send() did before the write queue: an async_write per frame,
+        // here with the frames kept alive until they are written.
+        StubServer server;
+        std::thread thread([&] {
+            server.accept();
+            server.discard(count * frame.size());
+        });
+        boost::asio::io_context io;
+        tcp::socket socket(io);
+        socket.connect({boost::asio::ip::make_address("127.0.0.1"), std::uint16_t(std::stoi(server.port()))});
+        std::vector<std::string> frames(count);
+        std::size_t written = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (auto& pending : frames) {
+            pending = frame;
+            boost::asio::async_write(socket, boost::asio::buffer(pending), [&](const boost::system::error_code&, std::size_t) {
+                ++written;
+            });
+        }
+        while (written < count) {
+            io.run_one();
+        }
+        thread.join();
+        state.report("async_write per frame", std::chrono::steady_clock::now() - start, count, count * frame.size());
+    }
+
+    const auto publish = [&](const std::string& label, auto&& pub) {
+        Connection conn;
+        std::atomic<bool> done = false;
+        conn.start([&](StubServer& server) {
+            server.readUntil("\r\n");
+            server.discard(count * frame.size());
+            done = true;
+        });
+        pub(conn.client, 0);
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 1; i <= count; ++i) {
+            pub(conn.client, i);
+            // keep the io_context turning like an application publishing from handlers.
+            if (i % 256 == 0) {
+                conn.io.poll();
+            }
+        }
+        conn.runUntil([&] { return done.load(); });
+        state.report(label, std::chrono::steady_clock::now() - start, count, count * frame.size());
+    };
+
+    publish("NATSClient::pub", [&](NATSClient& client, std::size_t i) {
+        if (i > 0) {
+            client.pub({.subject = "bench.subject", .payload = payload});
+        }
+    });
+    std::optional<NATSClient::Publisher> publisher;
+    publish("Publisher::pub", [&](NATSClient& client, std::size_t i) {
+        if (i == 0) {
+            publisher.emplace(client.publisher("bench.subject").value());
+        } else {
+            publisher->pub(payload);
+        }
+    });
+}
+
+NATS_BENCHMARK(publishEncode, "publish/encode 64KB") {
+    // queueing a PUB without the socket: what remains is the memory traffic.
+    constexpr std::size_t count = 64;
+    const std::string subject = "bench.subject";
+    const auto payload = std::make_shared<const std::string>(64 * 1024, 'x');
+    const auto bytes = count * (payload->size() + 32);
+    nats::WriteQueue queue;
+
+    state.run("concatenated frame", count, bytes, [&] {
+        for (std::size_t i = 0; i < count; ++i) {
+            queue.push("PUB " + subject + " " + std::to_string(payload->size()) + "\r\n" + *payload + "\r\n");
+        }
+        bench::doNotOptimize(queue.startWrite());
+        queue.finishWrite();
+    });
+
+    state.run("copied payload", count, bytes, [&] {
+        for (std::size_t i = 0; i < count; ++i) {
+            queue.append("PUB bench.subject 65536\r\n");
+            queue.append(*payload);
+            queue.append("\r\n");
+        }
+        bench::doNotOptimize(queue.startWrite());
+        queue.finishWrite();
+    });
+
+    state.run("shared payload", count, bytes, [&] {
+        for (std::size_t i = 0; i < count; ++i) {
+            queue.append("PUB bench.subject 65536\r\n");
+            queue.push(payload);
+            queue.append("\r\n");
+        }
+        bench::doNotOptimize(queue.startWrite());
+        queue.finishWrite();
+    });
+}
+
+NATS_BENCHMARK(clientPublishLarge, "client/publish 64KB") {
+    constexpr std::size_t count = 20'000;
+    const Message msg{.subject = "bench.subject", .payload = std::string(64 * 1024, 'x')};
+    const auto shared = std::make_shared<const std::string>(msg.payload);
+    const auto frameSize = std::string("PUB bench.subject 65536\r\n\r\n").size() + msg.payload.size();
+
+    const auto publish = [&](const std::string& label, auto&& pub) {
+        Connection conn;
+        std::atomic<bool> done = false;
+        conn.start([&](StubServer& server) {
+            server.readUntil("\r\n");
+            server.discard(count * frameSize);
+            done = true;
+        });
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < count; ++i) {
+            pub(conn.client);
+            if (i % 16 == 0) {
+                conn.io.poll();
+            }
+        }
+        conn.runUntil([&] { return done.load(); });
+        state.report(label, std::chrono::steady_clock::now() - start, count, count * frameSize);
+    };
+
+    publish("pub(const Message&)", [&](NATSClient& client) { client.pub(msg); });
+    publish("pub(subject, SharedPayload)", [&](NATSClient& client) { client.pub(msg.subject, shared); });
+}
+
+NATS_BENCHMARK(clientPublishBurst, "client/publish burst 10k") {
+    // bursts published from handlers: the io_context runs between publishes,
+    // so every idle moment starts a write unless the burst is corked.
+    constexpr std::size_t burst = 10'000;
+    constexpr std::size_t bursts = 50;
+    const std::string payload(100, 'x');
+    const auto frameSize = std::string("PUB bench.subject 100\r\n\r\n").size() + payload.size();
+
+    const auto publish = [&](const std::string& label, bool corked) {
+        Connection conn;
+        std::atomic<bool> done = false;
+        conn.start([&](StubServer& server) {
+            server.readUntil("\r\n");
+            server.discard(bursts * burst * frameSize);
+            done = true;
+        });
+        auto publisher = conn.client.publisher("bench.subject").value();
+        const auto writes = conn.client.stats().writes;
+        const auto syscalls = bench::sendCalls();
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t b = 0; b < bursts; ++b) {
+            std::optional<NATSClient::Batch> batch;
+            if (corked) {
+                batch.emplace(conn.client.batch());
+            }
+            for (std::size_t i = 0; i < burst; ++i) {
+                publisher.pub(payload);
+                conn.io.poll();
+            }
+        }
+        conn.runUntil([&] { return done.load(); });
+        state.report(label, std::chrono::steady_clock::now() - start, bursts * burst, bursts * burst * frameSize);
+        state.counter("writes/burst", double(conn.client.stats().writes - writes) / bursts);
+        state.counter("send syscalls/burst", double(bench::sendCalls() - syscalls) / bursts);
+    };
+
+    publish("uncorked", false);
+    publish("batch()", true);
+}
+
+NATS_BENCHMARK(clientPublishFlush, "client/publish + flush") {
+    // a barrier every `every` messages: publish, then wait for the flush.
+    constexpr std::size_t count = 1'000'000;
+    const std::string payload(100, 'x');
+    const auto frameSize = std::string("PUB bench.subject 100\r\n\r\n").size() + payload.size();
+
+    for (const std::size_t every : {100u, 1'000u, 10'000u}) {
+        Connection conn;
+        conn.start([&](StubServer& server) {
+            server.answerPings(count / every);
+            server.drain();
+        });
+        auto publisher = conn.client.publisher("bench.subject").value();
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t sent = 0; sent < count; sent += every) {
+            for (std::size_t i = 0; i < every; ++i) {
+                publisher.pub(payload);
+            }
+            bool flushed = false;
+            conn.client.flush([&](const boost::system::error_code&) {
+                flushed = true;
+            });
+            conn.runUntil([&] { return flushed; });
+        }
+        state.report("flush every " + std::to_string(every), std::chrono::steady_clock::now() - start, count, count * frameSize);
+    }
+}
+
+NATS_BENCHMARK(clientPublishBackpressure, "client/publish backpressure") {
+    // a producer that never yields to the io_context: without a limit the
+    // queue holds the whole run, with one it is bounded by the high-water mark.
+    constexpr std::size_t count = 1'000'000;
+    const std::string payload(100, 'x');
+    const auto frameSize = std::string("PUB bench.subject 100\r\n\r\n").size() + payload.size();
+
+    const auto publish = [&](const std::string& label, const NATSOptions& options, bool awaited) {
+        Connection conn(options);
+        std::atomic<bool> done = false;
+        conn.start([&](StubServer& server) {
+            server.readUntil("\r\n");
+            server.discard(count * frameSize);
+            done = true;
+        });
+        std::size_t peak = 0;
+        const auto start = std::chrono::steady_clock::now();
+        if (awaited) {
+            bool published = false;
+            net::co_spawn(conn.io, [&]() -> net::awaitable<void> {
+                for (std::size_t i = 0; i < count; ++i) {
+                    Message msg{.subject = "bench.subject", .payload = payload};
+                    co_await conn.client.asyncPub(std::move(msg), net::use_awaitable);
+                    peak = std::max(peak, conn.client.pending().bytes);
+                }
+                published = true;
+            }, net::detached);
+            while (!published) {
+                conn.io.run_one();
+            }
+        } else {
+            for (std::size_t i = 0; i < count; ++i) {
+                conn.client.pub({.subject = "bench.subject", .payload = payload});
+                peak = std::max(peak, conn.client.pending().bytes);
+            }
+        }
+        conn.runUntil([&] { return done.load(); });
+        state.report(label, std::chrono::steady_clock::now() - start, count, count * frameSize);
+        state.counter("peak queued KB", double(peak) / 1024);
+    };
+
+    publish("unlimited", {}, false);
+    NATSOptions limited;
+    limited.maxPendingBytes = 1024 * 1024;
+    limited.onFull = NATSOptions::OnFull::Block;
+    publish("1MB, block", limited, false);
+    publish("1MB, co_await asyncPub", limited, true);
+}
+
+NATS_BENCHMARK(clientPubSub, "client/pub+sub round trips") {
+    // the same workload on whichever socket backend the build uses: publish a
+    // batch, then wait for the server to deliver a batch back. Compare a
+    // build with NATS_IO_URING against the default one.
+#if defined(BOOST_ASIO_HAS_IO_URING)
+    const std::string backend = "io_uring";
+#else
+    const std::string backend = "epoll";
+#endif
+    constexpr std::size_t rounds = 20'000;
+    constexpr std::size_t batch = 100;
+    const std::string payload(100, 'x');
+    const auto pubSize = std::string("PUB bench.out 100\r\n\r\n").size() + payload.size();
+    std::string msgs;
+    for (std::size_t i = 0; i < batch; ++i) {
+        msgs += "MSG bench.in 1 100\r\n" + payload + "\r\n";
+    }
+
+    const auto roundTrips = [&](const std::string& label, const NATSOptions& options) {
+        Connection conn(options);
+        conn.start([&](StubServer& server) {
+            server.readUntil("SUB bench.in 1\r\n");
+            for (std::size_t round = 0; round < rounds; ++round) {
+                server.discard(batch * pubSize);
+                server.write(msgs);
+            }
+            server.drain();
+        });
+        std::size_t received = 0;
+        const auto subscription = conn.client.sub("bench.in", [&](const nats::MessageView& msg) {
+            ++received;
+        });
+        auto publisher = conn.client.publisher("bench.out").value();
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t round = 0; round < rounds; ++round) {
+            for (std::size_t i = 0; i < batch; ++i) {
+                publisher.pub(payload);
+            }
+            while (received < (round + 1) * batch) {
+                conn.io.run_one();
+            }
+        }
+        state.report(backend + ", " + label, std::chrono::steady_clock::now() - start, 2 * rounds * batch,
+            rounds * (batch * pubSize + msgs.size()));
+    };
+
+    roundTrips("slab", {});
+    NATSOptions ring;
+    ring.receiveBuffer = NATSOptions::ReceiveBuffer::Ring;
+    roundTrips("ring", ring);
+#if defined(BOOST_ASIO_HAS_IO_URING)
+    ring.registerBuffers = true;
+    roundTrips("ring, registered", ring);
+#endif
+}
+
+NATS_BENCHMARK(clientPublishZeroCopy, "client/publish zero-copy") {
+    // shared payloads, so the only copy left is the kernel's. Over loopback
+    // the kernel copies zero-copy sends anyway when it delivers them; the
+    // copied counter shows how many it did.
+    for (const std::size_t size : {16u << 10, 256u << 10, 1u << 20}) {
+        const std::size_t count = (1u << 30) / size;
+        const auto payload = std::make_shared<const std::string>(size, 'x');
+        const auto frameSize = std::string("PUB bench.subject \r\n\r\n").size() + std::to_string(size).size() + size;
+
+        const auto publish = [&](const std::string& label, bool zeroCopy) {
+            NATSOptions options;
+            options.zeroCopy = zeroCopy;
+            Connection conn(options);
+            std::atomic<bool> done = false;
+            conn.start([&](StubServer& server) {
+                server.readUntil("\r\n");
+                server.discard(count * frameSize);
+                done = true;
+            });
+            const auto start = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < count; ++i) {
+                conn.client.pub("bench.subject", payload);
+                if (i % 16 == 0) {
+                    conn.io.poll();
+                }
+            }
+            conn.runUntil([&] { return done.load(); });
+            state.report(std::to_string(size >> 10) + "KB " + label, std::chrono::steady_clock::now() - start, count, count * frameSize);
+            const auto& stats = conn.client.stats();
+            if (stats.zeroCopySends > 0) {
+                state.counter("copied by the kernel %", 100.0 * double(stats.zeroCopyCopied) / double(stats.zeroCopySends));
+            }
+        };
+
+        publish("copy", false);
+        publish("MSG_ZEROCOPY", true);
+    }
+}
+
+NATS_BENCHMARK(clientPublishPaths, "client/publish paths") {
+    // what an ingest loop pays per message, building the payload included.
+    for (const std::size_t size : {100u, 16u << 10}) {
+        const std::size_t count = size < 1024 ? 1'000'000 : 50'000;
+        const std::string subject = "bench.subject";
+        const std::string payload(size, 'x');
+        const auto frameSize = std::string("PUB bench.subject \r\n\r\n").size() + std::to_string(size).size() + size;
+
+        const auto publish = [&](const std::string& label, auto&& pub) {
+            Connection conn;
+            std::atomic<bool> done = false;
+            conn.start([&](StubServer& server) {
+                server.readUntil("\r\n");
+                server.discard(count * frameSize);
+                done = true;
+            });
+            const auto before = bench::allocations();
+            const auto start = std::chrono::steady_clock::now();
+            for (std::size_t sent = 0; sent < count; sent += 100) {
+                pub(conn.client);
+                conn.io.poll();
+            }
+            conn.runUntil([&] { return done.load(); });
+            state.report(std::to_string(size) + "B " + label, std::chrono::steady_clock::now() - start, count, count * frameSize);
+            state.counter("allocs/msg", double(bench::allocations() - before) / double(count));
+        };
+
+        publish("pub(const Message&)", [&](NATSClient& client) {
+            for (int i = 0; i < 100; ++i) {
+                const Message msg{.subject = subject, .payload = payload};
+                client.pub(msg);
+            }
+        });
+        publish("pub(subject, std::string&&)", [&](NATSClient& client) {
+            for (int i = 0; i < 100; ++i) {
+                client.pub(subject, std::string(payload));
+            }
+        });
+        publish("pub(subject, span<const byte>)", [&](NATSClient& client) {
+            for (int i = 0; i < 100; ++i) {
+                client.pub(subject, std::as_bytes(std::span(payload)));
+            }
+        });
+        std::vector<Message> msgs(100, Message{.subject = subject, .payload = payload});
+        publish("pubMany(100 messages)", [&](NATSClient& client) {
+            client.pubMany(msgs);
+        });
+    }
+}
@@ -0,0 +1,401 @@
+#include "bench.h"
+#include "nats/buffer.h"
+#include "nats/core.h"
+#include "nats/headers.h"
+#include "nats/scan.h"
+#include "nats/subject_trie.h"
+
+#include <boost/asio.hpp>
+#include <istream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+/// token by token pattern match, the baseline for the subject trie.
+bool matchesPattern(std::string_view pattern, std::string_view subject) {
+    while (true) {
+        const auto pdot = pattern.find('.');
+        const auto sdot = subject.find('.');
+        const auto ptoken = pattern.substr(0, pdot);
+        if (ptoken == ">") {
+            return !subject.empty();
+        }
+        if (ptoken != "*" && ptoken != subject.substr(0, sdot)) {
+            return false;
+        }
+        if (pdot == std::string_view::npos || sdot == std::string_view::npos) {
+            return pdot == sdot;
+        }
+        pattern.remove_prefix(pdot + 1);
+        subject.remove_prefix(sdot + 1);
+    }
+}
+
+/// the istream based tokenizer that nats::Core::handleMsg used before the
+/// resumable parser, kept as the baseline.
+nats::MessageResult legacyHandleMsg(std::streambuf& buf) {
+    std::istream is(&buf);
+    std::vector<std::string> tokens;
+    {
+        std::string line;
+        if (!std::getline(is, line) || line.empty() || line.back() != '\r') {
+            return std::unexpected(nats::Error{"malformed line"});
+        }
+
+        std::string token;
+        std::istringstream iss(line);
+        while (iss >> token) {
+            tokens.push_back(token);
+        }
+    }
+
+    if (tokens.size() < 4 || tokens[0] != "MSG") {
+        return std::unexpected{nats::Error{"bad syntax"}};
+    }
+
+    nats::Message msg { .subject=tokens[1], .sid=tokens[2]};
+    std::string bytes_as_str = "";
+    if (tokens.size() == 4) {
+        bytes_as_str = tokens[3];
+    } else if (tokens.size() == 5) {
+        msg.replyTo = tokens[3];
+        bytes_as_str = tokens[4];
+    } else {
+        return std::unexpected(nats::Error{"too many tokens"});
+    }
+
+    try {
+        msg.bytes = std::stoi(bytes_as_str);
+    } catch (...) {
+        return std::unexpected(nats::Error{"malformed bytes: " + bytes_as_str});
+    }
+
+    if (buf.in_avail() < static_cast<std::streamsize>(msg.bytes + 2)) {
+        return nats::MessageNeedsMoreData{ .bytes = msg.bytes + 2 - buf.in_avail(), .partial = msg };
+    }
+    msg.payload.resize(msg.bytes);
+    is.read(msg.payload.data(), msg.bytes);
+    buf.sbumpc();
+    buf.sbumpc();
+    return msg;
+}
+
+/// a streambuf reading a fixed string, rewound before every pass.
+struct ViewBuf : std::streambuf {
+    explicit ViewBuf(std::string& data) : data_(data) {}
+    void rewind() {
+        setg(data_.data(), data_.data(), data_.data() + data_.size());
+    }
+    std::string& data_;
+};
+
+std::string frames(std::size_t count, std::size_t payload, bool reply) {
+    std::string out;
+    const std::string body(payload, 'x');
+    for (std::size_t i = 0; i < count; ++i) {
+        out += "MSG telemetry.sensors.temperature 42 ";
+        if (reply) {
+            out += "_INBOX.XgT5ZcJPp3M6vVfyeJ8bQ1 ";
+        }
+        out += std::to_string(payload) + "\r\n" + body + "\r\n";
+    }
+    return out;
+}
+
+constexpr std::size_t batch = 1000;
+
+void parseFrames(bench::State& state, std::size_t payload, bool reply) {
+    auto data = frames(batch, payload, reply);
+    const std::string label = std::to_string(payload) + "B payload" + (reply ? " with reply" : "");
+
+    ViewBuf buf(data);
+    state.run("legacy istream " + label, batch, data.size(), [&] {
+        buf.rewind();
+        for (std::size_t i = 0; i < batch; ++i) {
+            bench::doNotOptimize(legacyHandleMsg(buf));
+        }
+    });
+
+    nats::Core core;
+    state.run("core streambuf " + label, batch, data.size(), [&] {
+        buf.rewind();
+        for (std::size_t i = 0; i < batch; ++i) {
+            bench::doNotOptimize(core.handleMsg(buf));
+        }
+    });
+
+    state.run("core in place " + label, batch, data.size(), [&] {
+        std::string_view rest = data;
+        std::size_t consumed = 0;
+        for (std::size_t i = 0; i < batch; ++i) {
+            bench::doNotOptimize(core.handleMsg(rest, consumed));
+            rest.remove_prefix(consumed);
+        }
+    });
+}
+
+} // namespace
+
+NATS_BENCHMARK(parseSmall, "parser/MSG small") {
+    parseFrames(state, 16, false);
+    parseFrames(state, 16, true);
+}
+
+NATS_BENCHMARK(parseMedium, "parser/MSG medium") {
+    parseFrames(state, 512, false);
+}
+
+NATS_BENCHMARK(parseSplit, "parser/MSG split reads") {
+    // deliver every frame in 7 byte reads to exercise resuming mid-header and mid-payload.
+    const auto data = frames(batch, 64, false);
+    nats::Core core;
+    state.run("core resume 7B reads 64B payload", batch, data.size(), [&] {
+        std::size_t begin = 0;
+        std::size_t end = 0;
+        std::size_t consumed = 0;
+        while (begin < data.size()) {
+            end = std::min(end + 7, data.size());
+            bench::doNotOptimize(core.handleMsg(std::string_view(data).substr(begin, end - begin), consumed));
+            begin += consumed;
+        }
+    });
+}
+
+NATS_BENCHMARK(scanFraming, "scan/MSG framing") {
+    // bytes/second through Core with each scanner, for small and large payload mixes.
+    const auto small = frames(batch, 16, true);
+    const auto large = frames(16, 64 * 1024, true);
+    for (const auto& impl : nats::scan::supported()) {
+        nats::scan::select(impl.name);
+        for (const auto* data : {&small, &large}) {
+            const auto count = data == &small ? batch : 16;
+            nats::Core core;
+            const std::string label = std::string(impl.name) + (data == &small ? " 16B payloads" : " 64KB payloads");
+            state.run(label, count, data->size(), [&] {
+                std::string_view rest = *data;
+                std::size_t consumed = 0;
+                for (std::size_t i = 0; i < count; ++i) {
+                    bench::doNotOptimize(core.handleMsg(rest, consumed));
+                    rest.remove_prefix(consumed);
+                }
+            });
+        }
+    }
+    nats::scan::select(nats::scan::supported().front().name);
+}
+
+NATS_BENCHMARK(scanLine, "scan/line end") {
+    // a long line (e.g. INFO) scanned for its terminator.
+    std::string line(4096, 'x');
+    line += "\r\n";
+    for (const auto& impl : nats::scan::supported()) {
+        state.run(std::string(impl.name) + " 4KB line", 1, line.size(), [&] {
+            bench::doNotOptimize(impl.findLineEnd(line.data(), line.size()));
+        });
+    }
+}
+
+NATS_BENCHMARK(deliverView, "delivery/view vs owning") {
+    // parse and hand every message of a received slab to a handler.
+    const auto data = frames(batch, 128, true);
+    nats::SlabBuffer buffer(data.size());
+    const auto space = buffer.prepare(data.size());
+    std::copy(data.begin(), data.end(), space.data());
+    buffer.commit(data.size());
+
+    nats::Core core;
+    std::size_t delivered = 0;
+    const auto ownedHandler = [&](const nats::Message& msg) { delivered += msg.payload.size(); };
+    const auto viewHandler = [&](const nats::MessageView& msg) { delivered += msg.payload.size(); };
+
+    auto before = bench::allocations();
+    auto passes = state.run("owning Message 128B", batch, data.size(), [&] {
+        std::string_view rest = buffer.data();
+        std::size_t consumed = 0;
+        for (std::size_t i = 0; i < batch; ++i) {
+            const auto result = core.handleMsg(rest, consumed);
+            ownedHandler(std::get<nats::Message>(result.value()));
+            rest.remove_prefix(consumed);
+        }
+    });
+    state.counter("allocs/msg", double(bench::allocations() - before) / (passes * batch));
+
+    before = bench::allocations();
+    passes = state.run("MessageView 128B", batch, data.size(), [&] {
+        std::string_view rest = buffer.data();
+        std::size_t consumed = 0;
+        for (std::size_t i = 0; i < batch; ++i) {
+            auto result = core.handleMsgView(rest, consumed);
+            auto& msg = std::get<nats::MessageView>(result.value());
+            msg.slab = buffer.slab();
+            viewHandler(msg);
+            rest.remove_prefix(consumed);
+        }
+    });
+    state.counter("allocs/msg", double(bench::allocations() - before) / (passes * batch));
+    bench::doNotOptimize(delivered);
+}
+
+NATS_BENCHMARK(batchDispatch, "batch/100B messages") {
+    // ~450 messages of 100 bytes fill a 64KB read.
+    constexpr std::size_t count = 450;
+    const auto data = frames(count, 100, false);
+    boost::asio::io_context io;
+    nats::Core core;
+    std::size_t delivered = 0;
+    const auto handler = [&](const nats::MessageView& msg) { delivered += msg.payload.size(); };
+
+    state.run("completion per message", count, data.size(), [&] {
+        // what async_read_until + one parse per completion amounted to.
+        std::string_view rest = data;
+        for (std::size_t i = 0; i < count; ++i) {
+            boost::asio::post(io, [&] {
+                std::size_t consumed = 0;
+                auto result = core.handleMsgView(rest, consumed);
+                handler(std::get<nats::MessageView>(result.value()));
+                rest.remove_prefix(consumed);
+            });
+            io.run();
+            io.restart();
+        }
+    });
+
+    std::vector<nats::MessageView> msgs;
+    state.run("handleMsgs per read", count, data.size(), [&] {
+        boost::asio::post(io, [&] {
+            const auto used = core.handleMsgs(data, msgs);
+            for (const auto& msg : msgs) {
+                handler(msg);
+            }
+            bench::doNotOptimize(used);
+        });
+        io.run();
+        io.restart();
+    });
+    bench::doNotOptimize(delivered);
+}
+
+NATS_BENCHMARK(opsMixed, "ops/mixed operations") {
+    // a verbose connection: every MSG is interleaved with control operations.
+    std::string data;
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < 250; ++i) {
+        data += "+OK\r\nMSG telemetry.sensors 42 16\r\n0123456789abcdef\r\nPING\r\nPONG\r\n";
+        count += 4;
+    }
+
+    ViewBuf buf(data);
+    state.run("first byte switch + istream", count, data.size(), [&] {
+        buf.rewind();
+        while (buf.sgetc() != std::char_traits<char>::eof()) {
+            if (buf.sgetc() == 'M') {
+                bench::doNotOptimize(legacyHandleMsg(buf));
+            } else {
+                std::istream is(&buf);
+                std::string line;
+                std::getline(is, line);
+                bench::doNotOptimize(line);
+            }
+        }
+    });
+
+    nats::Core core;
+    std::vector<nats::Op> ops;
+    state.run("Core::handleOps", count, data.size(), [&] {
+        bench::doNotOptimize(core.handleOps(data, ops));
+    });
+}
+
+NATS_BENCHMARK(headersRoundTrip, "headers/encode + decode") {
+    // a typical tracing header set: a handful of short fields per message.
+    constexpr std::size_t count = 1000;
+    const std::string block =
+        "NATS/1.0\r\nTrace-Id: 4bf92f3577b34da6\r\nSpan-Id: 00f067aa0ba902b7\r\n"
+        "Content-Type: application/json\r\nNats-Msg-Id: 1234\r\n\r\n";
+
+    state.run("std::map<string,string> decode", count, block.size() * count, [&] {
+        for (std::size_t i = 0; i < count; ++i) {
+            std::map<std::string, std::string> fields;
+            std::istringstream is(block);
+            std::string line;
+            std::getline(is, line);
+            while (std::getline(is, line) && line != "\r") {
+                const auto colon = line.find(':');
+                fields.emplace(line.substr(0, colon), line.substr(colon + 2, line.size() - colon - 3));
+            }
+            bench::doNotOptimize(fields);
+        }
+    });
+
+    auto before = bench::allocations();
+    const auto iterations = state.run("HeaderView::parse", count, block.size() * count, [&] {
+        for (std::size_t i = 0; i < count; ++i) {
+            bench::doNotOptimize(nats::HeaderView::parse(block));
+        }
+    });
+    state.counter("allocs/msg", double(bench::allocations() - before) / double(iterations * count));
+
+    nats::HeaderBuilder builder;
+    before = bench::allocations();
+    const auto encoded = state.run("HeaderBuilder reuse", count, block.size() * count, [&] {
+        for (std::size_t i = 0; i < count; ++i) {
+            builder.clear();
+            builder.add("Trace-Id", "4bf92f3577b34da6")
+                .add("Span-Id", "00f067aa0ba902b7")
+                .add("Content-Type", "application/json")
+                .add("Nats-Msg-Id", "1234");
+            bench::doNotOptimize(builder.encoded());
+        }
+    });
+    state.counter("allocs/msg", double(bench::allocations() - before) / double(encoded * count));
+}
+
+NATS_BENCHMARK(subjectsMatch, "subjects/match") {
+    // per tenant: a handler per device, one for any device and one for everything.
+    for (const std::size_t count : {10'000u, 100'000u}) {
+        const std::size_t tenants = count / 100;
+        std::vector<std::string> patterns;
+        for (std::size_t t = 0; t < tenants; ++t) {
+            const auto tenant = "tenant." + std::to_string(t);
+            for (std::size_t d = 0; d < 98; ++d) {
+                patterns.push_back(tenant + ".device." + std::to_string(d) + ".telemetry");
+            }
+            patterns.push_back(tenant + ".device.*.telemetry");
+            patterns.push_back(tenant + ".>");
+        }
+        std::vector<std::string> subjects;
+        for (std::size_t i = 0; i < 1000; ++i) {
+            subjects.push_back("tenant." + std::to_string(i * 7919 % tenants) + ".device." + std::to_string(i % 98) + ".telemetry");
+        }
+        const auto label = std::to_string(count / 1000) + "k patterns, ";
+
+        nats::SubjectTrie trie;
+        for (std::size_t i = 0; i < patterns.size(); ++i) {
+            trie.insert(patterns[i], i);
+        }
+        std::vector<nats::SubjectTrie::Id> ids;
+        state.run(label + "SubjectTrie", subjects.size(), 0, [&] {
+            for (const auto& subject : subjects) {
+                ids.clear();
+                trie.match(subject, ids);
+                bench::doNotOptimize(ids.data());
+            }
+        });
+
+        // a hundredth of the subjects: the scan visits every pattern for each.
+        state.run(label + "linear scan", 10, 0, [&] {
+            for (std::size_t i = 0; i < 10; ++i) {
+                ids.clear();
+                for (std::size_t p = 0; p < patterns.size(); ++p) {
+                    if (matchesPattern(patterns[p], subjects[i])) {
+                        ids.push_back(p);
+                    }
+                }
+                bench::doNotOptimize(ids.data());
+            }
+        });
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef NATS_STUB_SERVER_H
+#define NATS_STUB_SERVER_H
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <string>
+#include <string_view>
+
+/// @brief  A stand-in NATS server on a loopback port
+///
+/// The server uses blocking sockets on its own io_context so that a test can
+/// drive it from a separate thread while the client runs on the test thread.
+class StubServer {
+public:
+    StubServer()
+        : acceptor_(io_, boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0)) {}
+
+    std::string port() const {
+        return std::to_string(acceptor_.local_endpoint().port());
+    }
+
+    /// wait for the client to connect and greet it with INFO.
+    void accept() {
+        acceptSilently();
+        write("INFO {\"server_id\":\"stub\",\"server_name\":\"stub\",\"max_payload\":67108864}\r\n");
+    }
+
+    /// wait for the client to connect, leaving what is sent first to the test.
+    void acceptSilently() {
+        acceptor_.accept(socket_);
+        socket_.set_option(boost::asio::ip::tcp::no_delay(true));
+    }
+
+    void write(std::string_view bytes) {
+        boost::asio::write(socket_, boost::asio::buffer(bytes.data(), bytes.size()));
+    }
+
+    /// @brief  Wait for the client to send `text`
+    /// @return Everything received from the client up to and including `text`.
+    std::string readUntil(std::string_view text) {
+        auto pos = received_.find(text);
+        while (pos == std::string::npos) {
+            char chunk[65536];
+            const auto n = socket_.read_some(boost::asio::buffer(chunk));
+            received_.append(chunk, n);
+            pos = received_.find(text);
+        }
+        auto head = received_.substr(0, pos + text.size());
+        received_.erase(0, pos + text.size());
+        return head;
+    }
+
+    /// read and drop the next `bytes` bytes the client sends.
+    void discard(std::size_t bytes) {
+        const auto buffered = std::min(bytes, received_.size());
+        received_.erase(0, buffered);
+        bytes -= buffered;
+        char chunk[65536];
+        while (bytes > 0) {
+            const auto n = socket_.read_some(boost::asio::buffer(chunk, std::min(bytes, sizeof(chunk))));
+            bytes -= n;
+        }
+    }
+
+    /// @brief  Drop what the client sends, answering `pings` PINGs with PONG.
+    void answerPings(std::size_t pings) {
+        constexpr std::string_view ping = "PING\r\n";
+        while (pings > 0) {
+            if (const auto pos = received_.find(ping); pos != std::string::npos) {
+                received_.erase(0, pos + ping.size());
+                write("PONG\r\n");
+                --pings;
+                continue;
+            }
+            // keep what could be the start of a PING split across reads.
+            received_.erase(0, received_.size() - std::min(received_.size(), ping.size() - 1));
+            char chunk[65536];
+            const auto n = socket_.read_some(boost::asio::buffer(chunk));
+            received_.append(chunk, n);
+        }
+    }
+
+    /// read and drop everything the client sends until it disconnects.
+    std::size_t drain() {
+        std::size_t total = received_.size();
+        received_.clear();
+        boost::system::error_code ec;
+        char chunk[65536];
+        while (!ec) {
+            total += socket_.read_some(boost::asio::buffer(chunk), ec);
+        }
+        return total;
+    }
+
+    void close() {
+        boost::system::error_code ec;
+        socket_.close(ec);
+    }
+
+private:
+    boost::asio::io_context io_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    boost::asio::ip::tcp::socket socket_{io_};
+    std::string received_;
+};
+
+#endif // NATS_STUB_SERVER_H
@@ -1,10 +1,28 @@
+#include "nats/buffer.h"
+#include "nats/client.h"
 #include "nats/core.h"
+#include "nats/headers.h"
+#include "nats/inline_function.h"
+#include "nats/scan.h"
+#include "nats/spsc_queue.h"
 #include "nats/stream.h"
+#include "nats/subject_trie.h"
+#include "nats/write_queue.h"
+#include "stub_server.h"
 
+#include <array>
+#include <atomic>
 #include <boost/asio.hpp>
+#include <boost/asio/use_future.hpp>
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_templated.hpp>
+#include <chrono>
+#include <cstring>
 #include <expected>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 struct ExpectedMessageMatcher : Catch::Matchers::MatcherGenericBase {
     ExpectedMessageMatcher(const nats::Message& msg) : expected { msg }
     {}
@@ -93,8 +111,42 @@ TEST_CASE( "Header Continuation", "[message]") {
     os << "MSG test.subject 10 ";
 
     const auto result = core.handleMsg(buf);
-    REQUIRE_THAT(result, HasExpectedError(nats::Error{}));
- 
+    REQUIRE_THAT(result, HasExpectedNeedMoreData(nats::MessageNeedsMoreData{}));
+    REQUIRE(buf.size() == 20);
+}
+
+TEST_CASE( "Resume Header", "[message]") {
+    nats::Core core;
+
+    boost::asio::streambuf buf;
+    std::ostream os(&buf);
+    os << "MSG test.sub";
+    REQUIRE_THAT(core.handleMsg(buf), HasExpectedNeedMoreData(nats::MessageNeedsMoreData{}));
+
+    os << "ject 10 reply.to 3\r";
+    REQUIRE_THAT(core.handleMsg(buf), HasExpectedNeedMoreData(nats::MessageNeedsMoreData{}));
+
+    os << "\nhi!\r\nMSG";
+    const auto result = core.handleMsg(buf);
+    REQUIRE_THAT(result, HasExpectedMessage(nats::Message{"test.subject", "10", "reply.to", 3, "hi!"}));
+    REQUIRE(buf.size() == 3);
+}
+
+TEST_CASE( "Resume Payload", "[message]") {
+    nats::Core core;
+
+    const std::string frame = "MSG test.subject 10 5\r\nhello\r\n";
+    for (std::size_t split = 1; split < frame.size(); ++split) {
+        std::size_t consumed = 0;
+        const auto partial = core.handleMsg(std::string_view(frame).substr(0, split), consumed);
+        REQUIRE(partial.has_value());
+        REQUIRE(std::holds_alternative<nats::MessageNeedsMoreData>(partial.value()));
+        REQUIRE(consumed == 0);
+
+        const auto result = core.handleMsg(frame, consumed);
+        REQUIRE_THAT(result, HasExpectedMessage(nats::Message{"test.subject", "10", std::nullopt, 5, "hello"}));
+        REQUIRE(consumed == frame.size());
+    }
 }
 
 TEST_CASE( "Payload Continuation", "[message]" ) {
@@ -130,6 +182,17 @@ TEST_CASE( "Missing Bytes", "[message]" ) {
     REQUIRE_THAT(result, HasExpectedError(nats::Error{}));
 }
 
+TEST_CASE( "Too Many Tokens", "[message]" ) {
+    nats::Core core;
+
+    boost::asio::streambuf buf;
+    std::ostream os(&buf);
+    os << "MSG test.subject 10 reply.to extra 3\r\nhi!\r\n";
+
+    const auto result = core.handleMsg(buf);
+    REQUIRE_THAT(result, HasExpectedError(nats::Error{}));
+}
+
 TEST_CASE( "Missing CR", "[message]" ) {
     nats::Core core;
     
@@ -151,3 +214,1899 @@ TEST_CASE( "Missing LF", "[message]" ) {
     const auto result = core.handleMsg(buf);
     REQUIRE_THAT(result, HasExpectedError(nats::Error{}));
 }
+
+TEST_CASE( "Scanner Implementations Agree", "[scan]" ) {
+    std::string data(300, 'a');
+    for (std::size_t i = 0; i < data.size(); i += 7) {
+        data[i] = " \tx"[i % 3];
+    }
+    const auto& scalar = nats::scan::supported().back();
+    REQUIRE(std::string_view(scalar.name) == "scalar");
+
+    for (const auto& impl : nats::scan::supported()) {
+        INFO(impl.name);
+        for (std::size_t begin = 0; begin < 80; ++begin) {
+            for (const auto size : {0, 1, 15, 16, 17, 31, 32, 63, 64, 65, 200}) {
+                const auto n = std::min<std::size_t>(size, data.size() - begin);
+                REQUIRE(impl.spaceMask(data.data() + begin, n) == scalar.spaceMask(data.data() + begin, n));
+            }
+        }
+        for (std::size_t end = 0; end < data.size(); ++end) {
+            for (const char c : {'\r', '\n'}) {
+                auto line = data;
+                line[end] = c;
+                REQUIRE(impl.findLineEnd(line.data(), line.size()) == end);
+                REQUIRE(impl.findLineEnd(line.data(), end) == end);
+            }
+        }
+    }
+}
+
+TEST_CASE( "Long Control Line", "[message]" ) {
+    const std::string subject = "a." + std::string(100, 's');
+    const std::string reply = "_INBOX." + std::string(70, 'r');
+    const std::string frame = "MSG " + subject + "  7\t" + reply + " 3\r\nhi!\r\n";
+
+    for (const auto& impl : nats::scan::supported()) {
+        INFO(impl.name);
+        REQUIRE(nats::scan::select(impl.name));
+        nats::Core core;
+        std::size_t consumed = 0;
+        const auto result = core.handleMsg(frame, consumed);
+        REQUIRE_THAT(result, HasExpectedMessage(nats::Message{subject, "7", reply, 3, "hi!"}));
+        REQUIRE(consumed == frame.size());
+    }
+    REQUIRE(nats::scan::select(nats::scan::supported().front().name));
+}
+
+TEST_CASE( "Message View", "[message]" ) {
+    nats::Core core;
+
+    const std::string frame = "MSG test.subject 10 reply.to 3\r\nhi!\r\n";
+    std::size_t consumed = 0;
+    const auto result = core.handleMsgView(frame, consumed);
+    REQUIRE(result.has_value());
+    const auto& msg = std::get<nats::MessageView>(result.value());
+    REQUIRE(msg.subject == "test.subject");
+    REQUIRE(msg.sid == "10");
+    REQUIRE(msg.replyTo == "reply.to");
+    REQUIRE(msg.payload == "hi!");
+    REQUIRE(msg.payload.data() == frame.data() + 32);
+    REQUIRE(consumed == frame.size());
+    REQUIRE(msg.toMessage() == nats::Message{"test.subject", "10", "reply.to", 3, "hi!"});
+
+    const auto partial = core.handleMsgView(std::string_view(frame).substr(0, 34), consumed);
+    REQUIRE(partial.has_value());
+    REQUIRE(std::get<nats::MessageNeedsMoreData>(partial.value()) == nats::MessageNeedsMoreData{3, {}});
+}
+
+TEST_CASE( "Batch Of Messages", "[message]" ) {
+    nats::Core core;
+    std::vector<nats::MessageView> msgs;
+
+    const std::string data = "MSG a 1 1\r\nx\r\nMSG b 2 r 2\r\nyy\r\nPING\r\nMSG c 3 3\r\nzzz\r\n";
+    auto used = core.handleMsgs(data, msgs);
+    REQUIRE(used == 31);
+    REQUIRE(msgs.size() == 2);
+    REQUIRE(msgs[0].toMessage() == nats::Message{"a", "1", std::nullopt, 1, "x"});
+    REQUIRE(msgs[1].toMessage() == nats::Message{"b", "2", "r", 2, "yy"});
+
+    used = core.handleMsgs(std::string_view(data).substr(37, 12), msgs);
+    REQUIRE(used == 0);
+    REQUIRE(msgs.empty());
+    REQUIRE(core.bytesNeeded() == 4);
+
+    used = core.handleMsgs(std::string_view(data).substr(37), msgs);
+    REQUIRE(used == data.size() - 37);
+    REQUIRE(msgs.size() == 1);
+    REQUIRE(msgs[0].payload == "zzz");
+    REQUIRE_FALSE(core.bytesNeeded().has_value());
+
+    REQUIRE_FALSE(core.handleMsgs("MSG a 1 x\r\n", msgs).has_value());
+
+    // a NUL byte does not start a message either.
+    using namespace std::string_view_literals;
+    REQUIRE(core.handleMsgs("MSG a 1 1\r\nx\r\n\0MSG"sv, msgs) == 14);
+    REQUIRE(msgs.size() == 1);
+}
+
+TEST_CASE( "Protocol Operations", "[ops]" ) {
+    const std::string data =
+        "INFO {\"server_id\":\"x\"}\r\n"
+        "+OK\r\n"
+        "-ERR 'Unknown Protocol Operation'\r\n"
+        "PING\r\n"
+        "PONG\r\n"
+        "MSG foo 1 2\r\nhi\r\n"
+        "HMSG foo 2 reply 12 14\r\nNATS/1.0\r\n\r\nhi\r\n"
+        "ping\r\n";
+
+    const auto check = [](const std::vector<nats::Op>& ops) {
+        REQUIRE(ops.size() == 8);
+        REQUIRE(std::get<nats::Info>(ops[0]).json == "{\"server_id\":\"x\"}");
+        REQUIRE(std::holds_alternative<nats::Ok>(ops[1]));
+        REQUIRE(std::get<nats::Err>(ops[2]).message == "Unknown Protocol Operation");
+        REQUIRE(std::holds_alternative<nats::Ping>(ops[3]));
+        REQUIRE(std::holds_alternative<nats::Pong>(ops[4]));
+        const auto& msg = std::get<nats::MessageView>(ops[5]);
+        REQUIRE(msg.toMessage() == nats::Message{"foo", "1", std::nullopt, 2, "hi"});
+        REQUIRE(msg.headers.empty());
+        const auto& hmsg = std::get<nats::MessageView>(ops[6]);
+        REQUIRE(hmsg.toMessage() == nats::Message{"foo", "2", "reply", 2, "hi", "NATS/1.0\r\n\r\n"});
+        REQUIRE(hmsg.headers == "NATS/1.0\r\n\r\n");
+        REQUIRE(std::holds_alternative<nats::Ping>(ops[7]));
+    };
+
+    SECTION( "whole buffer" ) {
+        nats::Core core;
+        std::vector<nats::Op> ops;
+        REQUIRE(core.handleOps(data, ops) == data.size());
+        check(ops);
+    }
+
+    SECTION( "one byte at a time" ) {
+        nats::Core core;
+        std::vector<nats::Op> ops;
+        std::vector<nats::Op> all;
+        std::size_t used = 0;
+        for (std::size_t end = 1; end <= data.size(); ++end) {
+            const auto result = core.handleOps(std::string_view(data).substr(used, end - used), ops);
+            REQUIRE(result.has_value());
+            used += result.value();
+            all.insert(all.end(), ops.begin(), ops.end());
+        }
+        REQUIRE(used == data.size());
+        check(all);
+    }
+}
+
+TEST_CASE( "Malformed Operations", "[ops]" ) {
+    for (const std::string data : {"PUNG\r\n", "PINGS\r\n", "+OK extra\r\n", "INFOX\r\n", "HMSG foo 1 5 2\r\nhi\r\n", "HMSG foo 1 2\r\nhi\r\n"}) {
+        INFO(data);
+        nats::Core core;
+        std::vector<nats::Op> ops;
+        REQUIRE_FALSE(core.handleOps(data, ops).has_value());
+    }
+}
+
+TEST_CASE( "Max Payload", "[ops]" ) {
+    nats::Core core;
+    core.setMaxPayload(4);
+    std::vector<nats::Op> ops;
+    REQUIRE(core.handleOps("HMSG foo 1 2 4\r\n\r\nhi\r\n", ops).has_value());
+    // rejected on the control line, with the operations ahead of it kept.
+    const auto result = core.handleOps("PING\r\nMSG foo 1 5\r\nhel", ops);
+    REQUIRE_FALSE(result.has_value());
+    REQUIRE(result.error().what == "message exceeds max_payload of 4");
+    REQUIRE(ops.size() == 1);
+    REQUIRE(std::holds_alternative<nats::Ping>(ops[0]));
+}
+
+TEST_CASE( "Streamed Payload", "[ops]" ) {
+    nats::Core core;
+    std::vector<nats::Op> ops;
+
+    const std::string start = "+OK\r\nMSG foo 1 reply 10\r\n0123";
+    REQUIRE(core.handleOps(start, ops) == 5);
+    REQUIRE(ops.size() == 1);
+    const auto rest = std::string_view(start).substr(5);
+    const auto partial = core.partial(rest);
+    REQUIRE(partial.has_value());
+    REQUIRE(partial->sid == "1");
+    REQUIRE(partial->payload == "0123");
+
+    ops.clear();
+    REQUIRE(core.stream(rest, ops) == rest.size());
+    REQUIRE(ops.size() == 1);
+    auto chunk = std::get<nats::MessageChunk>(ops[0]);
+    REQUIRE(chunk.subject == "foo");
+    REQUIRE(chunk.replyTo == "reply");
+    REQUIRE(chunk.data == "0123");
+    REQUIRE(chunk.offset == 0);
+    REQUIRE(chunk.size == 10);
+    REQUIRE_FALSE(chunk.last());
+    REQUIRE_FALSE(core.bytesNeeded().has_value());
+
+    REQUIRE(core.handleOps("4567", ops) == 4);
+    chunk = std::get<nats::MessageChunk>(ops[0]);
+    REQUIRE(chunk.data == "4567");
+    REQUIRE(chunk.offset == 4);
+    REQUIRE(chunk.sid == "1");
+
+    // the last chunk and the first byte of the terminator.
+    REQUIRE(core.handleOps("89\r", ops) == 3);
+    REQUIRE(ops.size() == 1);
+    REQUIRE(std::get<nats::MessageChunk>(ops[0]).last());
+
+    REQUIRE(core.handleOps("\nPING\r\n", ops) == 7);
+    REQUIRE(ops.size() == 1);
+    REQUIRE(std::holds_alternative<nats::Ping>(ops[0]));
+
+    SECTION( "header block first" ) {
+        const std::string hmsg = "HMSG foo 2 12 14\r\nNATS/1.0";
+        REQUIRE(core.handleOps(hmsg, ops) == 0);
+        REQUIRE(core.partial(hmsg)->headers == "NATS/1.0");
+        REQUIRE(core.stream(hmsg, ops) == 0);
+
+        const std::string more = hmsg + "\r\n\r\n";
+        REQUIRE(core.handleOps(more, ops) == 0);
+        REQUIRE(core.stream(more, ops) == more.size());
+        chunk = std::get<nats::MessageChunk>(ops[0]);
+        REQUIRE(chunk.headers == "NATS/1.0\r\n\r\n");
+        REQUIRE(chunk.data.empty());
+        REQUIRE(chunk.size == 2);
+        REQUIRE(core.handleOps("hi\r\n", ops) == 4);
+        REQUIRE(std::get<nats::MessageChunk>(ops[0]).data == "hi");
+    }
+
+    SECTION( "malformed terminator" ) {
+        const std::string msg = "MSG foo 1 2\r\n";
+        REQUIRE(core.handleOps(msg, ops) == 0);
+        REQUIRE(core.stream(msg, ops) == msg.size());
+        REQUIRE_FALSE(core.handleOps("hiX\n", ops).has_value());
+    }
+}
+
+TEST_CASE( "Header Block", "[headers]" ) {
+    const auto headers = nats::HeaderView::parse("NATS/1.0\r\nTrace-Id: abc123\r\nSpan:  7 \r\nTrace-Id: def\r\n\r\n");
+    REQUIRE(headers.has_value());
+    REQUIRE(headers->status() == 0);
+    REQUIRE(headers->size() == 3);
+    REQUIRE(headers->get("Trace-Id") == "abc123");
+    REQUIRE(headers->get("Span") == "7");
+    REQUIRE_FALSE(headers->get("trace-id").has_value());
+
+    const auto status = nats::HeaderView::parse("NATS/1.0 503 No Responders\r\n\r\n");
+    REQUIRE(status.has_value());
+    REQUIRE(status->status() == 503);
+    REQUIRE(status->description() == "No Responders");
+    REQUIRE(status->empty());
+
+    const auto bare = nats::HeaderView::parse("NATS/1.0 408\r\n\r\n");
+    REQUIRE(bare.has_value());
+    REQUIRE(bare->status() == 408);
+    REQUIRE(bare->description().empty());
+
+    REQUIRE(nats::HeaderView::parse("")->empty());
+    REQUIRE_FALSE(nats::HeaderView::parse("HTTP/1.0\r\n\r\n").has_value());
+    REQUIRE_FALSE(nats::HeaderView::parse("NATS/1.0\r\nno colon\r\n\r\n").has_value());
+    REQUIRE_FALSE(nats::HeaderView::parse("NATS/1.0\r\nKey: value\r\n").has_value());
+}
+
+TEST_CASE( "Header Builder", "[headers]" ) {
+    nats::HeaderBuilder builder;
+    REQUIRE(builder.encoded() == "NATS/1.0\r\n\r\n");
+
+    builder.add("Trace-Id", "abc123").add("Span", "7");
+    REQUIRE(builder.encoded() == "NATS/1.0\r\nTrace-Id: abc123\r\nSpan: 7\r\n\r\n");
+    builder.status(503, "No Responders");
+    REQUIRE(builder.encoded() == "NATS/1.0 503 No Responders\r\nTrace-Id: abc123\r\nSpan: 7\r\n\r\n");
+
+    const auto decoded = nats::HeaderView::parse(builder.encoded());
+    REQUIRE(decoded.has_value());
+    REQUIRE(decoded->status() == 503);
+    REQUIRE(decoded->get("Span") == "7");
+    REQUIRE(builder.valid());
+
+    builder.add("Bad Key", "x");
+    REQUIRE_FALSE(builder.valid());
+    builder.clear();
+    REQUIRE(builder.valid());
+    REQUIRE(builder.encoded() == "NATS/1.0\r\n\r\n");
+}
+
+TEST_CASE( "Inline Function", "[function]" ) {
+    SECTION("holds move-only targets") {
+        auto value = std::make_unique<int>(41);
+        nats::InlineFunction<int(int)> add([value = std::move(value)](int n) { return *value + n; });
+        REQUIRE(add);
+        REQUIRE(add(1) == 42);
+
+        auto moved = std::move(add);
+        REQUIRE_FALSE(add);
+        REQUIRE(moved(2) == 43);
+    }
+
+    SECTION("calls mutable targets through const") {
+        int calls = 0;
+        const nats::InlineFunction<void()> count([&calls, n = 0]() mutable { calls = ++n; });
+        count();
+        count();
+        REQUIRE(calls == 2);
+    }
+
+    SECTION("moves large targets to the heap") {
+        std::array<std::uint64_t, 16> big{};
+        big[15] = 7;
+        // shared with the target, to see when it is destroyed.
+        const auto alive = std::make_shared<int>(0);
+        {
+            nats::InlineFunction<std::uint64_t()> last([big, alive] { return big[15]; });
+            nats::InlineFunction<std::uint64_t()> other;
+            other = std::move(last);
+            REQUIRE(other() == 7);
+            REQUIRE(alive.use_count() == 2);
+        }
+        REQUIRE(alive.use_count() == 1);
+    }
+
+    SECTION("ignores results for void") {
+        nats::InlineFunction<void(const std::string&)> drop([](const std::string& s) { return s.size(); });
+        drop("abc");
+        nats::InlineFunction<void()> empty(static_cast<void (*)()>(nullptr));
+        REQUIRE_FALSE(empty);
+    }
+}
+
+TEST_CASE( "SPSC Queue", "[queue]" ) {
+    SECTION("bounded and in order") {
+        nats::SpscQueue<std::string> queue(3);
+        REQUIRE(queue.capacity() == 4);
+        for (int i = 0; i < 4; ++i) {
+            REQUIRE(queue.push(std::to_string(i)));
+        }
+        REQUIRE_FALSE(queue.push("full"));
+        REQUIRE(queue.size() == 4);
+        REQUIRE(queue.pop() == "0");
+        REQUIRE(queue.push("4"));
+        for (int i = 1; i < 5; ++i) {
+            REQUIRE(queue.pop() == std::to_string(i));
+        }
+        REQUIRE_FALSE(queue.pop().has_value());
+        REQUIRE(queue.empty());
+    }
+
+    SECTION("across threads") {
+        constexpr std::size_t count = 100'000;
+        nats::SpscQueue<std::size_t> queue(64);
+        std::thread producer([&] {
+            for (std::size_t i = 0; i < count;) {
+                if (queue.push(std::size_t(i))) {
+                    ++i;
+                }
+            }
+        });
+        std::size_t next = 0;
+        auto ordered = true;
+        while (next < count) {
+            if (const auto value = queue.pop()) {
+                ordered = ordered && *value == next;
+                ++next;
+            }
+        }
+        producer.join();
+        REQUIRE(ordered);
+    }
+}
+
+TEST_CASE( "Subject Trie", "[subjects]" ) {
+    nats::SubjectTrie trie;
+    REQUIRE(trie.insert("orders.eu.created", 1));
+    REQUIRE(trie.insert("orders.*.created", 2));
+    REQUIRE(trie.insert("orders.>", 3));
+    REQUIRE(trie.insert("*.*.*", 4));
+    REQUIRE(trie.insert(">", 5));
+    REQUIRE(trie.insert("orders.>", 6));
+    REQUIRE(trie.size() == 6);
+
+    const auto match = [&](std::string_view subject) {
+        std::vector<nats::SubjectTrie::Id> ids;
+        trie.match(subject, ids);
+        std::ranges::sort(ids);
+        return ids;
+    };
+    REQUIRE(match("orders.eu.created") == std::vector<nats::SubjectTrie::Id>{1, 2, 3, 4, 5, 6});
+    REQUIRE(match("orders.us.created") == std::vector<nats::SubjectTrie::Id>{2, 3, 4, 5, 6});
+    REQUIRE(match("orders.eu") == std::vector<nats::SubjectTrie::Id>{3, 5, 6});
+    // `>` needs at least one more token.
+    REQUIRE(match("orders") == std::vector<nats::SubjectTrie::Id>{5});
+    REQUIRE(match("orders.eu.created.late") == std::vector<nats::SubjectTrie::Id>{3, 5, 6});
+
+    SECTION( "erased patterns stop matching" ) {
+        REQUIRE(trie.erase("orders.*.created", 2));
+        REQUIRE_FALSE(trie.erase("orders.*.created", 2));
+        REQUIRE_FALSE(trie.erase("orders.eu.created", 3));
+        REQUIRE(trie.erase("orders.>", 3));
+        REQUIRE(trie.size() == 4);
+        REQUIRE(match("orders.us.created") == std::vector<nats::SubjectTrie::Id>{4, 5, 6});
+        REQUIRE(trie.erase("orders.eu.created", 1));
+        REQUIRE(trie.erase("orders.>", 6));
+        REQUIRE(match("orders.eu.created") == std::vector<nats::SubjectTrie::Id>{4, 5});
+    }
+
+    SECTION( "invalid patterns" ) {
+        for (const auto* pattern : {"", ".", "a.", ".a", "a..b", "a.>.b", "a*", "a.b>", "a b"}) {
+            REQUIRE_FALSE(nats::SubjectTrie::validPattern(pattern));
+            REQUIRE_FALSE(trie.insert(pattern, 7));
+        }
+        REQUIRE(trie.size() == 6);
+    }
+}
+
+TEST_CASE( "Slab Buffer", "[buffer]" ) {
+    nats::SlabBuffer buffer(16);
+
+    auto space = buffer.prepare(10);
+    REQUIRE(space.size() == 16);
+    std::memcpy(space.data(), "0123456789", 10);
+    buffer.commit(10);
+    buffer.consume(4);
+    REQUIRE(buffer.data() == "456789");
+    REQUIRE(buffer.region().empty());
+
+    SECTION( "unreferenced slab is compacted" ) {
+        const auto* before = buffer.data().data();
+        space = buffer.prepare(10);
+        REQUIRE(buffer.data() == "456789");
+        REQUIRE(buffer.data().data() == before - 4);
+    }
+
+    SECTION( "referenced slab is left alone" ) {
+        const auto slab = buffer.slab();
+        const auto view = buffer.data();
+        space = buffer.prepare(10);
+        REQUIRE(buffer.slab() != slab);
+        REQUIRE(buffer.data() == "456789");
+        REQUIRE(view == "456789");
+    }
+
+    SECTION( "slab grows for large frames" ) {
+        space = buffer.prepare(100);
+        REQUIRE(space.size() >= 100);
+        REQUIRE(buffer.data() == "456789");
+    }
+}
+
+TEST_CASE( "Ring Buffer", "[buffer]" ) {
+    auto ring = nats::RingBuffer::create(100);
+    REQUIRE(ring.has_value());
+    auto& buffer = *ring.value();
+    const auto capacity = buffer.capacity();
+    REQUIRE(capacity >= 100);
+
+    // fill the ring up to a few bytes before its end.
+    auto space = buffer.prepare(capacity - 4);
+    REQUIRE(space.size() == capacity);
+    std::memset(space.data(), 'x', capacity - 4);
+    buffer.commit(capacity - 4);
+    buffer.consume(capacity - 4);
+    REQUIRE(buffer.data().empty());
+
+    SECTION( "a frame across the end stays contiguous" ) {
+        space = buffer.prepare(10);
+        REQUIRE(space.size() == capacity);
+        std::memcpy(space.data(), "0123456789", 10);
+        buffer.commit(10);
+        REQUIRE(buffer.data() == "0123456789");
+        buffer.consume(6);
+        REQUIRE(buffer.data() == "6789");
+        REQUIRE(buffer.slab() == nullptr);
+        // reads land inside the fixed region.
+        const auto region = buffer.region();
+        REQUIRE(region.size() == 2 * capacity);
+        REQUIRE(space.data() >= region.data());
+        REQUIRE(space.data() + space.size() <= region.data() + region.size());
+    }
+
+    SECTION( "the ring grows for large frames" ) {
+        space = buffer.prepare(4);
+        std::memcpy(space.data(), "abcd", 4);
+        buffer.commit(4);
+        space = buffer.prepare(capacity);
+        REQUIRE(space.size() >= capacity);
+        REQUIRE(buffer.capacity() > capacity);
+        REQUIRE(buffer.data() == "abcd");
+        REQUIRE(buffer.region().size() == 2 * buffer.capacity());
+    }
+}
+
+TEST_CASE( "Write Queue", "[write]" ) {
+    nats::WriteQueue queue;
+    const auto bytes = [](const std::vector<boost::asio::const_buffer>& buffers) {
+        std::string all;
+        for (const auto& buffer : buffers) {
+            all.append(static_cast<const char*>(buffer.data()), buffer.size());
+        }
+        return all;
+    };
+
+    queue.push("PING\r\n");
+    queue.push("PUB a 1\r\nx\r\n");
+    REQUIRE(queue.queuedBytes() == 18);
+    const auto& first = queue.startWrite();
+    REQUIRE(queue.writing());
+    REQUIRE(queue.empty());
+    REQUIRE(first.size() == 1);
+    REQUIRE(bytes(first) == "PING\r\nPUB a 1\r\nx\r\n");
+
+    // frames queued during the write wait for the next one; large frames are not copied.
+    std::string large(nats::WriteQueue::coalesce_limit + 1, 'y');
+    const auto* largeData = large.data();
+    queue.push("SUB b 2\r\n");
+    queue.push(std::move(large));
+    queue.push("PONG\r\n");
+    const auto* block = static_cast<const char*>(first.front().data());
+    queue.finishWrite();
+    REQUIRE_FALSE(queue.writing());
+
+    const auto& second = queue.startWrite();
+    REQUIRE(second.size() == 3);
+    REQUIRE(second[1].data() == largeData);
+    REQUIRE(bytes(second) == "SUB b 2\r\n" + std::string(nats::WriteQueue::coalesce_limit + 1, 'y') + "PONG\r\n");
+    const std::vector<const void*> blocks = {block, second[0].data(), second[2].data()};
+    queue.finishWrite();
+
+    // written blocks are reused.
+    queue.push("PING\r\n");
+    REQUIRE(std::ranges::find(blocks, queue.startWrite().front().data()) != blocks.end());
+    queue.finishWrite();
+
+    SECTION( "shared payloads are referenced" ) {
+        const auto payload = std::make_shared<const std::string>(nats::WriteQueue::coalesce_limit + 1, 's');
+        queue.append("PUB c 4097\r\n");
+        queue.push(payload);
+        queue.append("\r\n");
+        const auto& buffers = queue.startWrite();
+        REQUIRE(buffers.size() == 3);
+        REQUIRE(buffers[1].data() == payload->data());
+        REQUIRE(payload.use_count() == 2);
+        queue.finishWrite();
+        REQUIRE(payload.use_count() == 1);
+    }
+
+    SECTION( "large copies get a segment of their own" ) {
+        const std::string payload(nats::WriteQueue::coalesce_limit + 1, 'c');
+        queue.append("x");
+        queue.append(payload);
+        queue.append("y");
+        const auto& buffers = queue.startWrite();
+        REQUIRE(buffers.size() == 3);
+        REQUIRE(buffers[1].data() != payload.data());
+        REQUIRE(bytes(buffers) == "x" + payload + "y");
+        queue.finishWrite();
+    }
+    SECTION( "zero-copy writes are kept until the kernel releases them" ) {
+        const auto payload = std::make_shared<const std::string>(nats::WriteQueue::coalesce_limit + 1, 'z');
+        queue.append("PUB d 4097\r\n");
+        queue.push(payload);
+        queue.append("\r\n");
+        REQUIRE(queue.largestSegment() == payload->size());
+        queue.startWrite();
+        REQUIRE(queue.largestSegment() == 0);
+        // written with two sends, numbered 0 and 1.
+        queue.finishWrite(2);
+        REQUIRE(queue.pinnedBytes() == payload->size() + 14);
+        REQUIRE(payload.use_count() == 2);
+
+        queue.release(1, 1);
+        REQUIRE(payload.use_count() == 2);
+        queue.release(0, 0);
+        REQUIRE(queue.pinnedBytes() == 0);
+        REQUIRE(payload.use_count() == 1);
+
+        // a write whose sends were all copied has nothing to wait for.
+        queue.push("PING\r\n");
+        queue.startWrite();
+        queue.finishWrite(2);
+        REQUIRE(queue.pinnedBytes() == 0);
+    }
+}
+
+namespace {
+
+/// run the client's io_context until the condition holds.
+template <typename Condition>
+bool runUntil(boost::asio::io_context& io, Condition&& condition) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        io.restart();
+        io.run_one_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+} // namespace
+
+TEST_CASE( "Client Delivers Messages Split Across Reads", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::atomic<bool> connected = false;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        connected = true;
+        server.readUntil("SUB foo 1\r\n");
+        const std::string frames = "MSG foo 1 5\r\nhello\r\nPING\r\nMSG foo 1 _INBOX.1 3\r\nhi!\r\nMSG foo 1 6\r\nworld!\r\n";
+        for (std::size_t i = 0; i < frames.size(); i += 7) {
+            server.write(std::string_view(frames).substr(i, 7));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        server.readUntil("PONG\r\n");
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+
+    std::vector<nats::Message> received;
+    const auto subscription = client.sub("foo", [&](const nats::MessageView& msg) {
+        REQUIRE(msg.slab);
+        received.push_back(msg.toMessage());
+    });
+    REQUIRE(runUntil(io, [&] { return received.size() == 3; }));
+    thread.join();
+
+    REQUIRE(received[0] == nats::Message{"foo", "1", std::nullopt, 5, "hello"});
+    REQUIRE(received[1] == nats::Message{"foo", "1", "_INBOX.1", 3, "hi!"});
+    REQUIRE(received[2] == nats::Message{"foo", "1", std::nullopt, 6, "world!"});
+    client.shutdown();
+}
+
+TEST_CASE( "Client Keeps Retained Views Valid Across Reads", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    const auto frame = [](char c, std::size_t size) {
+        return "MSG foo 1 " + std::to_string(size) + "\r\n" + std::string(size, c) + "\r\n";
+    };
+    // more than a slab of messages nobody keeps, so that the slab fills up.
+    std::string filler;
+    for (std::size_t i = 0; i < 100; ++i) {
+        filler += frame('f', 1000);
+    }
+
+    std::atomic<bool> connected = false;
+    std::atomic<std::size_t> received = 0;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        connected = true;
+        server.readUntil("SUB foo 1\r\n");
+        // each write is only sent once the one before has been handled, so it is a read of its own.
+        const auto send = [&](const std::string& frames, std::size_t total) {
+            server.write(frames);
+            while (received < total) {
+                std::this_thread::yield();
+            }
+        };
+        send(frame('a', 5), 1);
+        send(frame('b', 5), 2);
+        send(filler, 102);
+        send(frame('c', 5), 103);
+        send(filler, 203);
+        server.drain();
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+    std::vector<nats::MessageView> kept;
+    const auto subscription = client.sub("foo", [&](const nats::MessageView& msg) {
+        if (msg.payload.front() != 'f') {
+            kept.push_back(msg);
+        }
+        ++received;
+    });
+
+    // a view kept from the first read is not overwritten by the second.
+    REQUIRE(runUntil(io, [&] { return received == 2; }));
+    REQUIRE(kept.size() == 2);
+    REQUIRE(kept[0].payload == "aaaaa");
+    REQUIRE(kept[1].payload == "bbbbb");
+
+    // once released, the slab is reused; one kept from it after that survives
+    // the reads that fill it up.
+    kept.clear();
+    REQUIRE(runUntil(io, [&] { return received == 102; }));
+    REQUIRE(runUntil(io, [&] { return received == 203; }));
+    client.shutdown();
+    thread.join();
+    REQUIRE(kept.size() == 1);
+    REQUIRE(kept[0].payload == "ccccc");
+}
+
+TEST_CASE( "Client Receives Into A Ring", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port(), {.receiveBuffer = NATSOptions::ReceiveBuffer::Ring, .ringSize = 4096});
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    // frames of varying length wrap around the one page ring at every offset.
+    std::string frames;
+    for (int i = 0; i < 2000; ++i) {
+        const auto payload = std::to_string(i) + std::string(i % 37, '.');
+        frames += "MSG ring 1 " + std::to_string(payload.size()) + "\r\n" + payload + "\r\n";
+    }
+
+    std::atomic<bool> connected = false;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        connected = true;
+        server.readUntil("SUB ring 1\r\n");
+        for (std::size_t i = 0; i < frames.size(); i += 1500) {
+            server.write(std::string_view(frames).substr(i, 1500));
+        }
+        server.drain();
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+
+    std::vector<std::string> received;
+    const auto subscription = client.sub("ring", [&](const nats::MessageView& msg) {
+        REQUIRE_FALSE(msg.slab);
+        received.emplace_back(msg.payload);
+    });
+    REQUIRE(runUntil(io, [&] { return received.size() == 2000; }));
+    client.shutdown();
+    thread.join();
+
+    for (int i = 0; i < 2000; ++i) {
+        REQUIRE(received[i] == std::to_string(i) + std::string(i % 37, '.'));
+    }
+}
+
+TEST_CASE( "Client Receives Large Messages", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::string payload(3 * 1024 * 1024 + 17, '\0');
+    for (std::size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = char('a' + i % 26);
+    }
+
+    std::atomic<bool> connected = false;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        connected = true;
+        server.readUntil("SUB big 1\r\n");
+        // the control line and the start of the payload arrive in one read,
+        // followed by a small message in the same write as the tail.
+        const std::string frames = "MSG big 1 " + std::to_string(payload.size()) + "\r\n" + payload + "\r\nMSG big 1 2\r\nok\r\n";
+        server.write(std::string_view(frames).substr(0, 1000));
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        server.write(std::string_view(frames).substr(1000));
+        server.drain();
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+
+    std::vector<nats::Message> received;
+    const auto subscription = client.sub("big", [&](const nats::MessageView& msg) {
+        received.push_back(msg.toMessage());
+    });
+    REQUIRE(runUntil(io, [&] { return received.size() == 2; }));
+    REQUIRE(received[0].payload.size() == payload.size());
+    REQUIRE(received[0].payload == payload);
+    REQUIRE(received[1].payload == "ok");
+    client.shutdown();
+    thread.join();
+}
+
+TEST_CASE( "Client Streams Chunked Subscriptions", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::string payload(1024 * 1024, '\0');
+    for (std::size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = char('a' + i % 26);
+    }
+
+    std::atomic<bool> connected = false;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        connected = true;
+        server.readUntil("SUB big 1\r\n");
+        const std::string frames = "MSG big 1 2\r\nok\r\nMSG big 1 " + std::to_string(payload.size()) + "\r\n" + payload + "\r\nPING\r\n";
+        for (std::size_t i = 0; i < frames.size(); i += 100'000) {
+            server.write(std::string_view(frames).substr(i, 100'000));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        server.readUntil("PONG\r\n");
+        server.drain();
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+
+    std::size_t chunks = 0;
+    std::size_t largest = 0;
+    std::vector<std::string> received;
+    const auto subscription = client.sub("big", [&](const nats::MessageChunk& chunk) {
+        if (chunk.offset == 0) {
+            received.emplace_back();
+        }
+        REQUIRE(chunk.subject == "big");
+        REQUIRE(chunk.offset == received.back().size());
+        received.back() += chunk.data;
+        largest = std::max(largest, chunk.data.size());
+        ++chunks;
+    });
+    REQUIRE(runUntil(io, [&] { return received.size() == 2 && received[1].size() == payload.size(); }));
+    client.shutdown();
+    thread.join();
+
+    REQUIRE(received[0] == "ok");
+    REQUIRE(received[1] == payload);
+    REQUIRE(chunks > 2);
+    // the client reads 64K at a time at most, never the whole payload.
+    REQUIRE(largest <= 64 * 1024);
+}
+
+TEST_CASE( "Client Rejects Messages Over Max Payload", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    std::atomic<bool> rejected = false;
+    client.setLogging([&](LogLevel, const std::string& text) {
+        rejected = rejected || text.find("max_payload") != std::string::npos;
+    });
+
+    SECTION( "past the default before INFO" ) {
+        std::thread thread([&] {
+            // no INFO has announced a limit yet.
+            server.acceptSilently();
+            server.write("MSG big 1 " + std::to_string(NATSInfo{}.max_payload + 1) + "\r\n");
+            server.drain();
+        });
+
+        client.start();
+        REQUIRE(runUntil(io, [&] { return rejected.load(); }));
+        thread.join();
+    }
+
+    SECTION( "with most of the payload in the same read" ) {
+        auto chunked = false;
+        SECTION( "buffered" ) {}
+        SECTION( "chunked" ) {
+            chunked = true;
+        }
+        std::atomic<bool> connected = false;
+        std::thread thread([&] {
+            server.accept();
+            server.write("INFO {\"server_name\":\"x\",\"max_payload\":1024}\r\n");
+            server.readUntil("CONNECT");
+            connected = true;
+            server.readUntil("SUB big 2\r\n");
+            // only the last few bytes of the payload are missing.
+            server.write("MSG ok 1 2\r\nhi\r\nMSG big 2 2000\r\n" + std::string(1990, 'x'));
+            server.drain();
+        });
+
+        client.start();
+        REQUIRE(runUntil(io, [&] { return connected.load(); }));
+        std::vector<std::string> ok;
+        std::size_t big = 0;
+        const auto okSub = client.sub("ok", [&](const nats::MessageView& msg) {
+            ok.emplace_back(msg.payload);
+        });
+        const auto bigSub = chunked
+            ? client.sub("big", [&](const nats::MessageChunk& chunk) { ++big; })
+            : client.sub("big", [&](const nats::MessageView& msg) { ++big; });
+        REQUIRE(runUntil(io, [&] { return rejected.load(); }));
+        thread.join();
+        // the message ahead of it in the read is still delivered.
+        REQUIRE(ok == std::vector<std::string>{"hi"});
+        REQUIRE(big == 0);
+    }
+}
+
+TEST_CASE( "Client Writes Frames In Order", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::string expected;
+    for (int i = 0; i < 20000; ++i) {
+        const auto payload = std::to_string(i) + (i % 1000 == 0 ? std::string(10000, 'z') : "");
+        expected += "PUB foo " + std::to_string(payload.size()) + "\r\n" + payload + "\r\n";
+    }
+
+    std::atomic<bool> connected = false;
+    std::atomic<bool> done = false;
+    std::string frames;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        server.readUntil("\r\n");
+        connected = true;
+        frames = server.readUntil("PUB foo 5\r\n19999\r\n");
+        done = true;
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+    // published in one go, while earlier writes are still in flight.
+    for (int i = 0; i < 20000; ++i) {
+        client.pub({.subject = "foo", .payload = std::to_string(i) + (i % 1000 == 0 ? std::string(10000, 'z') : "")});
+    }
+    REQUIRE(runUntil(io, [&] { return done.load(); }));
+    thread.join();
+    REQUIRE(frames == expected);
+    client.shutdown();
+}
+
+TEST_CASE( "Client Publishes Shared Payloads", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::atomic<bool> connected = false;
+    std::atomic<bool> done = false;
+    std::string frames;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        server.readUntil("\r\n");
+        connected = true;
+        frames = server.readUntil("end\r\n");
+        done = true;
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+    const auto payload = std::make_shared<const std::string>(100000, 'p');
+    client.pub("foo", payload);
+    client.pub("foo", payload, "reply");
+    const nats::Message last{.subject = "bar", .payload = "end"};
+    client.pub(last);
+    REQUIRE(runUntil(io, [&] { return done.load(); }));
+    thread.join();
+
+    REQUIRE(frames == "PUB foo 100000\r\n" + *payload + "\r\nPUB foo reply 100000\r\n" + *payload + "\r\nPUB bar 3\r\nend\r\n");
+    // released once written.
+    REQUIRE(payload.use_count() == 1);
+    client.shutdown();
+}
+
+TEST_CASE( "Client Publisher", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    REQUIRE_FALSE(client.publisher("").has_value());
+    REQUIRE_FALSE(client.publisher("foo.*").has_value());
+    REQUIRE_FALSE(client.publisher("foo.>").has_value());
+    REQUIRE_FALSE(client.publisher("foo..bar").has_value());
+    REQUIRE_FALSE(client.publisher(".foo").has_value());
+    REQUIRE_FALSE(client.publisher("foo bar").has_value());
+    REQUIRE_FALSE(client.publisher("foo", "reply.").has_value());
+
+    std::atomic<bool> connected = false;
+    std::atomic<bool> done = false;
+    std::string frames;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        server.readUntil("\r\n");
+        connected = true;
+        frames = server.readUntil("last\r\n");
+        done = true;
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+    auto events = client.publisher("events.created");
+    auto requests = client.publisher("svc.echo", "_INBOX.1");
+    REQUIRE(events.has_value());
+    REQUIRE(requests.has_value());
+    events->pub("one");
+    requests->pub("");
+    events->pub(std::make_shared<const std::string>(5000, 'b'));
+    requests->pub("last");
+    REQUIRE(runUntil(io, [&] { return done.load(); }));
+    thread.join();
+
+    REQUIRE(frames ==
+        "PUB events.created 3\r\none\r\n"
+        "PUB svc.echo _INBOX.1 0\r\n\r\n"
+        "PUB events.created 5000\r\n" + std::string(5000, 'b') + "\r\n"
+        "PUB svc.echo _INBOX.1 4\r\nlast\r\n");
+    client.shutdown();
+}
+
+TEST_CASE( "Client Batches Publishes", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::atomic<bool> connected = false;
+    std::atomic<bool> done = false;
+    std::string frames;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        server.readUntil("\r\n");
+        connected = true;
+        frames = server.readUntil("PUB foo 3\r\n999\r\n");
+        done = true;
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+    REQUIRE(runUntil(io, [&] { return client.stats().bytesWritten > 0; }));
+    const auto before = client.stats();
+
+    std::string expected;
+    {
+        const auto batch = client.batch();
+        client.cork();
+        for (int i = 0; i < 1000; ++i) {
+            client.pub({.subject = "foo", .payload = std::to_string(i)});
+            expected += "PUB foo " + std::to_string(std::to_string(i).size()) + "\r\n" + std::to_string(i) + "\r\n";
+            io.poll();
+        }
+        client.uncork();
+        // still held back by the batch.
+        REQUIRE(client.stats().writes == before.writes);
+    }
+    REQUIRE(client.stats().writes == before.writes + 1);
+    REQUIRE(runUntil(io, [&] { return done.load(); }));
+    thread.join();
+    REQUIRE(frames == expected);
+    REQUIRE(runUntil(io, [&] { return client.stats().bytesWritten == before.bytesWritten + expected.size(); }));
+    client.shutdown();
+}
+
+TEST_CASE( "Client Flush", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::atomic<bool> connected = false;
+    std::atomic<int> pings = 0;
+    std::atomic<bool> answer = false;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        connected = true;
+        // answer only once both flushes have been sent.
+        server.readUntil("PING\r\n");
+        server.readUntil("PING\r\n");
+        pings = 2;
+        while (!answer) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        server.write("PONG\r\n");
+        server.readUntil("PING\r\n");
+        server.write("PONG\r\nPONG\r\n");
+        server.readUntil("PING\r\n");
+        server.write("PONG\r\n");
+        server.readUntil("PING\r\n");
+        server.close();
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+
+    std::vector<int> order;
+    client.pub({.subject = "foo", .payload = "bar"});
+    client.flush([&](const boost::system::error_code& ec) {
+        REQUIRE_FALSE(ec);
+        order.push_back(1);
+    });
+    client.flush([&](const boost::system::error_code& ec) {
+        REQUIRE_FALSE(ec);
+        order.push_back(2);
+    });
+    REQUIRE(runUntil(io, [&] { return pings == 2; }));
+    REQUIRE(order.empty());
+    answer = true;
+    REQUIRE(runUntil(io, [&] { return order.size() == 1; }));
+    REQUIRE(order.front() == 1);
+
+    // a future completes once the PONG has been read on the io thread.
+    auto future = client.flush(net::use_future);
+    REQUIRE(runUntil(io, [&] { return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }));
+    REQUIRE(order == std::vector<int>{1, 2});
+    REQUIRE_NOTHROW(future.get());
+
+    bool awaited = false;
+    net::co_spawn(io, [&]() -> net::awaitable<void> {
+        co_await client.flush(net::use_awaitable);
+        awaited = true;
+    }, net::detached);
+    REQUIRE(runUntil(io, [&] { return awaited; }));
+
+    // outstanding flushes fail when the connection closes.
+    boost::system::error_code failed;
+    client.flush([&](const boost::system::error_code& ec) {
+        failed = ec;
+    });
+    REQUIRE(runUntil(io, [&] { return bool(failed); }));
+    REQUIRE(failed == net::error::not_connected);
+    thread.join();
+
+    // and flushes started after it fail right away instead of waiting for a PONG.
+    auto late = client.flush(net::use_future);
+    REQUIRE(runUntil(io, [&] { return late.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }));
+    REQUIRE_THROWS_AS(late.get(), boost::system::system_error);
+}
+
+TEST_CASE( "Client Publishes Headers", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::atomic<bool> connected = false;
+    std::atomic<bool> done = false;
+    std::string frames;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        connected = true;
+        server.readUntil("\r\n");
+        frames = server.readUntil("there\r\n");
+        done = true;
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+    nats::HeaderBuilder headers;
+    headers.add("Trace-Id", "abc");
+    client.hpub({.subject = "foo", .replyTo = "bar", .payload = "hi"}, headers);
+    client.pub({.subject = "foo", .payload = "there", .headers = std::string(headers.encoded())});
+    REQUIRE(runUntil(io, [&] { return done.load(); }));
+    thread.join();
+
+    REQUIRE(frames ==
+        "HPUB foo bar 27 29\r\nNATS/1.0\r\nTrace-Id: abc\r\n\r\nhi\r\n"
+        "HPUB foo 27 32\r\nNATS/1.0\r\nTrace-Id: abc\r\n\r\nthere\r\n");
+    client.shutdown();
+}
+
+TEST_CASE( "Client Outbound High-Water Marks", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSOptions options;
+    options.maxPendingMsgs = 4;
+    options.blockTimeout = std::chrono::milliseconds(20);
+    SECTION( "fail fast" ) {
+        options.onFull = NATSOptions::OnFull::Fail;
+    }
+    SECTION( "block with a timeout" ) {
+        options.onFull = NATSOptions::OnFull::Block;
+    }
+    NATSClient client(io, "127.0.0.1", server.port(), options);
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::atomic<bool> connected = false;
+    std::atomic<bool> done = false;
+    std::string frames;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        server.readUntil("\r\n");
+        connected = true;
+        frames = server.readUntil("end\r\n");
+        done = true;
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load() && client.pending().bytes == 0; }));
+
+    std::string expected;
+    const auto pub = [&](const std::string& payload) {
+        auto result = client.pub({.subject = "foo", .payload = payload});
+        if (result.has_value()) {
+            expected += "PUB foo " + std::to_string(payload.size()) + "\r\n" + payload + "\r\n";
+        }
+        return result;
+    };
+
+    client.cork();
+    for (int i = 0; i < 4; ++i) {
+        REQUIRE(pub(std::to_string(i)).has_value());
+    }
+    REQUIRE(client.pending().msgs == 4);
+    REQUIRE(client.pending().bytes == expected.size());
+
+    if (options.onFull == NATSOptions::OnFull::Fail) {
+        const auto full = pub("4");
+        REQUIRE_FALSE(full.has_value());
+        REQUIRE(full.error().message == "outbound queue is full");
+        client.uncork();
+    } else {
+        // nothing is written while corked.
+        const auto start = std::chrono::steady_clock::now();
+        const auto timedOut = pub("4");
+        REQUIRE_FALSE(timedOut.has_value());
+        REQUIRE(timedOut.error().message == "timed out waiting for the outbound queue");
+        REQUIRE(std::chrono::steady_clock::now() - start >= options.blockTimeout);
+
+        // a handler cannot wait for writes that need it to return first.
+        std::optional<NATSClient::PubResult> inside;
+        net::post(io, [&] { inside = pub("4"); });
+        io.poll();
+        REQUIRE(inside.has_value());
+        REQUIRE_FALSE(inside->has_value());
+
+        // nor does it undo a stop of the io_context.
+        io.stop();
+        const auto stopped = pub("4");
+        REQUIRE_FALSE(stopped.has_value());
+        REQUIRE(stopped.error().message == "outbound queue is full and the io_context is stopped");
+        REQUIRE(io.stopped());
+        io.restart();
+
+        client.uncork();
+        REQUIRE(pub("4").has_value());
+        REQUIRE(client.pending().msgs <= 3);
+    }
+    REQUIRE(runUntil(io, [&] { return client.pending().msgs == 0; }));
+    REQUIRE(pub("end").has_value());
+    REQUIRE(runUntil(io, [&] { return done.load(); }));
+    thread.join();
+    REQUIRE(frames == expected);
+    client.shutdown();
+}
+
+TEST_CASE( "Client Awaits Outbound Room", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSOptions options;
+    options.maxPendingMsgs = 2;
+    NATSClient client(io, "127.0.0.1", server.port(), options);
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::atomic<bool> connected = false;
+    std::atomic<bool> done = false;
+    std::atomic<bool> close = false;
+    std::string frames;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        server.readUntil("\r\n");
+        connected = true;
+        frames = server.readUntil("end\r\n");
+        done = true;
+        while (!close) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        server.close();
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load() && client.pending().bytes == 0; }));
+
+    client.cork();
+    // completes right away while there is room.
+    bool queued = false;
+    client.asyncPub({.subject = "foo", .payload = "a"}, [&](const boost::system::error_code& ec) {
+        REQUIRE_FALSE(ec);
+        queued = true;
+    });
+    REQUIRE(client.pub({.subject = "foo", .payload = "b"}).has_value());
+    io.poll();
+    REQUIRE(queued);
+
+    bool sent = false;
+    net::co_spawn(io, [&]() -> net::awaitable<void> {
+        Message msg{.subject = "foo", .payload = "c"};
+        co_await client.asyncPub(std::move(msg), net::use_awaitable);
+        sent = true;
+    }, net::detached);
+    io.poll();
+    REQUIRE_FALSE(sent);
+    REQUIRE(client.pending().msgs == 2);
+    // later publishes do not overtake a waiting one.
+    REQUIRE_FALSE(client.pub({.subject = "foo", .payload = "d"}).has_value());
+
+    client.uncork();
+    REQUIRE(runUntil(io, [&] { return sent; }));
+    REQUIRE(client.pub({.subject = "foo", .payload = "end"}).has_value());
+    REQUIRE(runUntil(io, [&] { return done.load(); }));
+    REQUIRE(frames == "PUB foo 1\r\na\r\nPUB foo 1\r\nb\r\nPUB foo 1\r\nc\r\nPUB foo 3\r\nend\r\n");
+
+    // waiting publishes fail when the connection closes.
+    REQUIRE(runUntil(io, [&] { return client.pending().msgs == 0; }));
+    client.cork();
+    REQUIRE(client.pub({.subject = "foo", .payload = "e"}).has_value());
+    REQUIRE(client.pub({.subject = "foo", .payload = "f"}).has_value());
+    boost::system::error_code failed;
+    client.asyncPub({.subject = "foo", .payload = "g"}, [&](const boost::system::error_code& ec) {
+        failed = ec;
+    });
+    close = true;
+    REQUIRE(runUntil(io, [&] { return bool(failed); }));
+    REQUIRE(failed == net::error::not_connected);
+    thread.join();
+
+    // the frames that were not written are dropped, and later publishes fail right away.
+    REQUIRE(client.pending().msgs == 0);
+    REQUIRE(client.pending().bytes == 0);
+    boost::system::error_code late;
+    client.asyncPub({.subject = "foo", .payload = "h"}, [&](const boost::system::error_code& ec) {
+        late = ec;
+    });
+    REQUIRE(runUntil(io, [&] { return bool(late); }));
+    REQUIRE(late == net::error::not_connected);
+    const auto after = client.pub({.subject = "foo", .payload = "i"});
+    REQUIRE_FALSE(after.has_value());
+    REQUIRE(after.error().message == "not connected");
+}
+
+TEST_CASE( "Client Sends Large Payloads With MSG_ZEROCOPY", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSOptions options;
+    options.zeroCopy = true;
+    NATSClient client(io, "127.0.0.1", server.port(), options);
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::atomic<bool> connected = false;
+    std::atomic<bool> done = false;
+    std::string frames;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        server.readUntil("\r\n");
+        connected = true;
+        frames = server.readUntil("end\r\n");
+        done = true;
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load() && client.pending().bytes == 0; }));
+    const auto payload = std::make_shared<const std::string>(options.zeroCopyMinSize, 'z');
+    client.pub("foo", payload);
+    REQUIRE(runUntil(io, [&] { return client.pending().bytes == 0; }));
+    client.pub({.subject = "bar", .payload = "end"});
+    REQUIRE(runUntil(io, [&] { return done.load(); }));
+    thread.join();
+    REQUIRE(frames == "PUB foo 16384\r\n" + *payload + "\r\nPUB bar 3\r\nend\r\n");
+
+    // only the write with the large payload goes without a copy, and its
+    // buffers are kept until the kernel reports it done.
+    REQUIRE(client.stats().zeroCopySends >= 1);
+    REQUIRE(runUntil(io, [&] { return client.stats().zeroCopyDone == client.stats().zeroCopySends; }));
+    REQUIRE(payload.use_count() == 1);
+    client.shutdown();
+}
+
+TEST_CASE( "Client Publishes Owned And Borrowed Payloads", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSOptions options;
+    options.maxPendingMsgs = 4;
+    NATSClient client(io, "127.0.0.1", server.port(), options);
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::atomic<bool> connected = false;
+    std::atomic<bool> done = false;
+    std::string frames;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        server.readUntil("\r\n");
+        connected = true;
+        frames = server.readUntil("end\r\n");
+        done = true;
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load() && client.pending().bytes == 0; }));
+    client.cork();
+
+    // taken over by the queue.
+    std::string owned(nats::WriteQueue::coalesce_limit + 1, 'o');
+    REQUIRE(client.pub("foo", std::move(owned), "reply").has_value());
+
+    // copied before pub() returns.
+    std::array<std::byte, 3> bytes{std::byte{'a'}, std::byte{'b'}, std::byte{'c'}};
+    REQUIRE(client.pub("bytes", bytes).has_value());
+    bytes.fill(std::byte{'z'});
+
+    nats::HeaderBuilder headers;
+    headers.add("K", "v");
+    const std::vector<Message> msgs = {
+        {.subject = "one", .payload = "1"},
+        {.subject = "two", .payload = "2", .headers = std::string(headers.encoded())},
+    };
+    REQUIRE(client.pubMany(msgs).has_value());
+    REQUIRE(client.pending().msgs == 4);
+
+    // admitted as a whole: nothing is queued when they do not all fit.
+    const auto refused = client.pubMany(msgs);
+    REQUIRE_FALSE(refused.has_value());
+    REQUIRE(client.pending().msgs == 4);
+
+    client.uncork();
+    REQUIRE(runUntil(io, [&] { return client.pending().msgs == 0; }));
+    REQUIRE(client.pub("last", std::string("end")).has_value());
+    REQUIRE(runUntil(io, [&] { return done.load(); }));
+    thread.join();
+
+    REQUIRE(frames ==
+        "PUB foo reply 4097\r\n" + std::string(nats::WriteQueue::coalesce_limit + 1, 'o') + "\r\n"
+        "PUB bytes 3\r\nabc\r\n"
+        "PUB one 1\r\n1\r\n"
+        "HPUB two 18 19\r\nNATS/1.0\r\nK: v\r\n\r\n2\r\n"
+        "PUB last 3\r\nend\r\n");
+    client.shutdown();
+}
+
+TEST_CASE( "Client Routes Messages To Local Handlers", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::atomic<bool> connected = false;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        connected = true;
+        server.readUntil("SUB orders.> 1\r\n");
+        server.write(
+            "MSG orders.eu.created 1 1\r\na\r\n"
+            "MSG orders.us.created 1 1\r\nb\r\n"
+            "MSG orders.eu.cancelled 1 1\r\nc\r\n");
+        server.drain();
+    });
+
+    std::vector<std::string> all, created, eu;
+    REQUIRE(client.route("orders.>", [&](const nats::MessageView& msg) {
+        all.emplace_back(msg.payload);
+    }).has_value());
+    REQUIRE(client.route("orders.*.created", [&](const nats::MessageView& msg) {
+        created.emplace_back(msg.payload);
+    }).has_value());
+    // removes itself after the first message.
+    NATSClient::RouteId euRoute = 0;
+    euRoute = client.route("orders.eu.*", [&](const nats::MessageView& msg) {
+        eu.emplace_back(msg.payload);
+        client.unroute(euRoute);
+    }).value();
+    REQUIRE_FALSE(client.route("orders.>.x", [](const nats::MessageView&) {}).has_value());
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+    const auto subscription = client.subRouted("orders.>");
+    REQUIRE(runUntil(io, [&] { return all.size() == 3; }));
+    client.shutdown();
+    thread.join();
+
+    REQUIRE(all == std::vector<std::string>{"a", "b", "c"});
+    REQUIRE(created == std::vector<std::string>{"a", "b"});
+    REQUIRE(eu == std::vector<std::string>{"a"});
+}
+
+TEST_CASE( "Client Allocates Sids For Subscription Handles", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    // the slot of the second subscription is reused with the next generation.
+    const auto reusedSid = std::to_string((NATSClient::Sid{1} << 32) | 2);
+    std::atomic<bool> connected = false;
+    std::string sent;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        connected = true;
+        server.readUntil("SUB b 2\r\n");
+        server.write("MSG a 1 1\r\nx\r\nMSG a 1 1\r\ny\r\n");
+        sent = server.readUntil("SUB c " + reusedSid + "\r\n");
+        // the first message goes to a sid that has been unsubscribed.
+        server.write("MSG b 2 1\r\nz\r\nMSG c " + reusedSid + " 1\r\nw\r\n");
+        server.drain();
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+
+    std::vector<std::string> a, b, c;
+    NATSClient::Subscription subA;
+    // unsubscribes itself from its handler, so "y" is dropped.
+    subA = client.sub("a", [&](const nats::MessageView& msg) {
+        a.emplace_back(msg.payload);
+        subA.unsubscribe();
+    });
+    auto subB = client.sub("b", [&](const nats::MessageView& msg) {
+        b.emplace_back(msg.payload);
+    });
+    REQUIRE(subA.sid() == 1);
+    REQUIRE(subB.sid() == 2);
+    REQUIRE(runUntil(io, [&] { return !subA; }));
+    {
+        const auto moved = std::move(subB);
+        REQUIRE_FALSE(subB);
+    }
+    const auto subC = client.sub("c", [&](const nats::MessageView& msg) {
+        c.emplace_back(msg.payload);
+    });
+    REQUIRE(std::to_string(subC.sid()) == reusedSid);
+    REQUIRE(runUntil(io, [&] { return c.size() == 1; }));
+    client.shutdown();
+    thread.join();
+
+    REQUIRE(sent.find("UNSUB 1\r\n") != std::string::npos);
+    REQUIRE(sent.find("UNSUB 2\r\n") != std::string::npos);
+    REQUIRE(a == std::vector<std::string>{"x"});
+    REQUIRE(b.empty());
+    REQUIRE(c == std::vector<std::string>{"w"});
+}
+
+TEST_CASE( "Client Delivers Queued Subscriptions On Workers", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port(), {.workers = 2});
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::atomic<bool> connected = false, started = false, answered = false;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        connected = true;
+        server.readUntil("SUB slow 2\r\n");
+        std::string frames;
+        for (std::size_t i = 0; i < 100; ++i) {
+            const auto payload = std::to_string(i);
+            frames += "MSG fast 1 " + std::to_string(payload.size()) + "\r\n" + payload + "\r\n";
+        }
+        server.write(frames + "MSG slow 2 1\r\nx\r\n");
+        // the rest arrive while the worker is held by the first.
+        while (!started) {
+            std::this_thread::yield();
+        }
+        frames.clear();
+        for (std::size_t i = 0; i < 9; ++i) {
+            frames += "MSG slow 2 1\r\nx\r\n";
+        }
+        server.write(frames + "PING\r\n");
+        server.readUntil("PONG\r\n");
+        answered = true;
+        server.drain();
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+
+    // only touched by the worker running the handler.
+    std::vector<std::string> fast;
+    std::set<std::thread::id> fastThreads;
+    std::atomic<std::size_t> fastCount = 0, slowCount = 0;
+    std::atomic<bool> release = false;
+    const auto fastSub = client.sub("fast", [&](const nats::Message& msg) {
+        fast.push_back(msg.payload);
+        fastThreads.insert(std::this_thread::get_id());
+        ++fastCount;
+    }, {.pendingMsgs = 128});
+    // holds its worker until released, so its queue of four fills up.
+    const auto slowSub = client.sub("slow", [&](const nats::MessageView& msg) {
+        started = true;
+        while (!release) {
+            std::this_thread::yield();
+        }
+        ++slowCount;
+    }, {.pendingMsgs = 4});
+    REQUIRE(runUntil(io, [&] { return answered && fastCount == 100 && slowSub.pending().msgs == 4; }));
+    REQUIRE(slowSub.pending().bytes == 4);
+    REQUIRE(slowSub.dropped() == 5);
+    REQUIRE(fastSub.pending().msgs == 0);
+
+    release = true;
+    REQUIRE(runUntil(io, [&] { return slowCount == 5; }));
+    client.shutdown();
+    thread.join();
+
+    std::vector<std::string> expected;
+    for (std::size_t i = 0; i < 100; ++i) {
+        expected.push_back(std::to_string(i));
+    }
+    REQUIRE(fast == expected);
+    REQUIRE_FALSE(fastThreads.contains(std::this_thread::get_id()));
+    REQUIRE(slowSub.pending().msgs == 0);
+}
+
+TEST_CASE( "Client Keeps Subject Order Across Partitions", "[client]" ) {
+    constexpr std::size_t subjects = 8;
+    constexpr std::size_t perSubject = 50;
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port(), {.workers = 2});
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    std::atomic<bool> connected = false;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        connected = true;
+        server.readUntil("SUB part.* 1\r\n");
+        std::string frames;
+        for (std::size_t i = 0; i < perSubject; ++i) {
+            for (std::size_t subject = 0; subject < subjects; ++subject) {
+                const auto payload = std::to_string(i);
+                frames += "MSG part." + std::to_string(subject) + " 1 " + std::to_string(payload.size()) + "\r\n" + payload + "\r\n";
+            }
+        }
+        server.write(frames);
+        server.drain();
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+
+    std::mutex mutex;
+    std::map<std::string, std::vector<std::string>> delivered;
+    std::atomic<std::size_t> count = 0;
+    const auto subscription = client.sub("part.*", [&](const nats::Message& msg) {
+        {
+            std::lock_guard lock(mutex);
+            delivered[msg.subject].push_back(msg.payload);
+        }
+        ++count;
+    }, {.pendingMsgs = 1024, .partitions = 4});
+    REQUIRE(runUntil(io, [&] { return count == subjects * perSubject; }));
+    client.shutdown();
+    thread.join();
+
+    std::vector<std::string> expected;
+    for (std::size_t i = 0; i < perSubject; ++i) {
+        expected.push_back(std::to_string(i));
+    }
+    REQUIRE(delivered.size() == subjects);
+    for (const auto& [subject, payloads] : delivered) {
+        REQUIRE(payloads == expected);
+    }
+    REQUIRE(subscription.dropped() == 0);
+}
+
+TEST_CASE( "Client Limits Slow Consumers", "[client]" ) {
+    // the handler holds the worker on the first message until released,
+    // while the rest arrive.
+    struct Result {
+        std::vector<std::string> delivered;
+        std::uint64_t dropped = 0;
+        NATSClient::Pending pending;
+        std::vector<NATSClient::Sid> errors;
+        bool disconnected = false;
+    };
+    const auto run = [](const NATSSubOptions& options, const std::vector<std::string>& rest, std::size_t deliveries) {
+        StubServer server;
+        boost::asio::io_context io;
+        NATSClient client(io, "127.0.0.1", server.port());
+        client.setLogging([](LogLevel, const std::string&) {});
+        Result result;
+        client.setErrorHandler([&](NATSClient::Sid sid, const NATSError&) {
+            result.errors.push_back(sid);
+        });
+
+        std::atomic<bool> connected = false, started = false, release = false, answered = false, closed = false;
+        const auto disconnect = options.onSlowConsumer == NATSSubOptions::OnSlowConsumer::Disconnect;
+        std::thread thread([&] {
+            server.accept();
+            server.readUntil("CONNECT");
+            connected = true;
+            server.readUntil("SUB slow 1\r\n");
+            server.write("MSG slow 1 1\r\n0\r\n");
+            while (!started) {
+                std::this_thread::yield();
+            }
+            std::string frames;
+            for (const auto& payload : rest) {
+                frames += "MSG slow 1 " + std::to_string(payload.size()) + "\r\n" + payload + "\r\n";
+            }
+            server.write(disconnect ? frames : frames + "PING\r\n");
+            if (!disconnect) {
+                server.readUntil("PONG\r\n");
+                answered = true;
+            }
+            server.drain();
+            closed = true;
+        });
+
+        client.start();
+        REQUIRE(runUntil(io, [&] { return connected.load(); }));
+        std::mutex mutex;
+        auto subscription = client.sub("slow", [&](const nats::MessageView& msg) {
+            started = true;
+            while (!release) {
+                std::this_thread::yield();
+            }
+            std::lock_guard lock(mutex);
+            result.delivered.emplace_back(msg.payload);
+        }, options);
+        REQUIRE(runUntil(io, [&] { return disconnect ? closed.load() : answered.load(); }));
+        result.pending = subscription.pending();
+        result.dropped = subscription.dropped();
+        result.disconnected = closed;
+        release = true;
+        REQUIRE(runUntil(io, [&] {
+            std::lock_guard lock(mutex);
+            return result.delivered.size() == deliveries;
+        }));
+        client.shutdown();
+        thread.join();
+        // the errors are posted to the client's executor.
+        io.restart();
+        io.poll();
+        std::lock_guard lock(mutex);
+        return result;
+    };
+
+    SECTION("drop newest past the byte limit") {
+        const auto result = run({.pendingMsgs = 100, .pendingBytes = 10}, {"1111", "2222", "3333", "4444"}, 3);
+        REQUIRE(result.pending.msgs == 2);
+        REQUIRE(result.pending.bytes == 8);
+        REQUIRE(result.dropped == 2);
+        REQUIRE(result.delivered == std::vector<std::string>{"0", "1111", "2222"});
+        REQUIRE(result.errors == std::vector<NATSClient::Sid>{1});
+        REQUIRE_FALSE(result.disconnected);
+    }
+
+    SECTION("drop oldest") {
+        const auto result = run({.pendingMsgs = 4, .onSlowConsumer = NATSSubOptions::OnSlowConsumer::DropOldest},
+            {"1", "2", "3", "4", "5", "6"}, 5);
+        // the queue keeps them until the worker is back.
+        REQUIRE(result.pending.msgs == 6);
+        REQUIRE(result.delivered == std::vector<std::string>{"0", "3", "4", "5", "6"});
+        REQUIRE(result.errors.size() == 1);
+    }
+
+    SECTION("disconnect") {
+        const auto result = run({.pendingMsgs = 1, .onSlowConsumer = NATSSubOptions::OnSlowConsumer::Disconnect}, {"1", "2", "3"}, 2);
+        REQUIRE(result.disconnected);
+        REQUIRE(result.dropped == 2);
+        REQUIRE(result.delivered == std::vector<std::string>{"0", "1"});
+        REQUIRE(result.errors.size() == 1);
+    }
+}
+
+TEST_CASE( "Client Auto-Unsubscribes After N Messages", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    // the slot of the first subscription is free again once its limit is reached.
+    const auto reusedSid = std::to_string((NATSClient::Sid{1} << 32) | 1);
+    std::atomic<bool> connected = false;
+    std::string sent;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        connected = true;
+        sent += server.readUntil("SUB two 1\r\nUNSUB 1 2\r\n");
+        // the third one is past the limit, as if sent before the UNSUB arrived.
+        server.write("MSG two 1 1\r\nx\r\nMSG two 1 1\r\ny\r\nMSG two 1 1\r\nz\r\n");
+        sent += server.readUntil("SUB n " + reusedSid + "\r\n");
+        server.write("MSG n " + reusedSid + " 1\r\na\r\n");
+        sent += server.readUntil("UNSUB " + reusedSid + " 3\r\n");
+        server.write("MSG n " + reusedSid + " 1\r\nb\r\nMSG n " + reusedSid + " 1\r\nc\r\n");
+        // answer the request on the inbox it subscribed to.
+        const auto head = server.readUntil(" 2\r\nhi\r\n");
+        sent += head;
+        const auto sub = head.rfind("SUB _INBOX.");
+        const auto inbox = head.substr(sub + 4, head.find(' ', sub + 4) - sub - 4);
+        const auto sidStart = sub + 5 + inbox.size();
+        const auto sid = head.substr(sidStart, head.find("\r\n", sidStart) - sidStart);
+        server.write("MSG " + inbox + " " + sid + " 2\r\nok\r\n");
+        server.drain();
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+
+    std::vector<std::string> two, n;
+    const auto twoSub = client.sub("two", [&](const nats::MessageView& msg) {
+        two.emplace_back(msg.payload);
+    }, {.autoUnsubscribe = 2});
+    REQUIRE(runUntil(io, [&] { return two.size() == 2; }));
+
+    auto nSub = client.sub("n", [&](const nats::MessageView& msg) {
+        n.emplace_back(msg.payload);
+    });
+    REQUIRE(std::to_string(nSub.sid()) == reusedSid);
+    REQUIRE(runUntil(io, [&] { return n.size() == 1; }));
+    nSub.unsubscribe(3);
+    REQUIRE(runUntil(io, [&] { return n.size() == 3; }));
+
+    std::optional<std::string> answer;
+    request(client, {.subject = "svc", .payload = "hi"}, [&](const nats::Message& msg) {
+        answer = msg.payload;
+    });
+    REQUIRE(runUntil(io, [&] { return answer.has_value(); }));
+    client.shutdown();
+    thread.join();
+
+    REQUIRE(two == std::vector<std::string>{"x", "y"});
+    REQUIRE(n == std::vector<std::string>{"a", "b", "c"});
+    REQUIRE(answer == "ok");
+    // the server ends them itself, so the client sends no plain UNSUB.
+    REQUIRE(sent.find("UNSUB 1\r\n") == std::string::npos);
+    REQUIRE(sent.find("UNSUB " + reusedSid + "\r\n") == std::string::npos);
+    REQUIRE(sent.find(" 1\r\nPUB svc _INBOX.") != std::string::npos);
+
+    // numbered behind a random prefix of each client's own.
+    const auto inbox = client.newInbox();
+    const auto prefix = inbox.substr(0, inbox.rfind('.') + 1);
+    REQUIRE(prefix.starts_with("_INBOX."));
+    REQUIRE(prefix.size() > std::string_view("_INBOX.").size() + 1);
+    REQUIRE(inbox == prefix + "2");
+    REQUIRE(sent.find("PUB svc " + prefix + "1 2\r\n") != std::string::npos);
+    NATSClient other(io, "127.0.0.1", server.port());
+    REQUIRE_FALSE(other.newInbox().starts_with(prefix));
+}
+
+TEST_CASE( "Client Drops The Inbox Of A Request It Cannot Publish", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSOptions options;
+    options.maxPendingMsgs = 1;
+    NATSClient client(io, "127.0.0.1", server.port(), options);
+    client.setLogging([](LogLevel, const std::string&) {});
+
+    // nothing is written while corked, so the queue stays full.
+    client.cork();
+    REQUIRE(client.pub({.subject = "foo", .payload = "a"}).has_value());
+    const auto result = request(client, {.subject = "svc", .payload = "hi"}, [](const nats::Message&) {});
+    REQUIRE_FALSE(result.has_value());
+    REQUIRE(result.error().message == "outbound queue is full");
+    // the slot of the inbox is free again, so the next subscription takes it over.
+    const auto next = client.sub("bar", [](const nats::MessageView&) {});
+    REQUIRE(next.sid() == ((NATSClient::Sid{1} << 32) | 1));
+}
+
+TEST_CASE( "Client Reports The Sid Of A Subscription Ending On A Dropped Message", "[client]" ) {
+    StubServer server;
+    boost::asio::io_context io;
+    NATSClient client(io, "127.0.0.1", server.port());
+    client.setLogging([](LogLevel, const std::string&) {});
+    std::vector<NATSClient::Sid> errors;
+    client.setErrorHandler([&](NATSClient::Sid sid, const NATSError&) {
+        errors.push_back(sid);
+    });
+
+    std::atomic<bool> connected = false, started = false, release = false;
+    std::thread thread([&] {
+        server.accept();
+        server.readUntil("CONNECT");
+        connected = true;
+        server.readUntil("UNSUB 1 3\r\n");
+        server.write("MSG slow 1 1\r\nx\r\n");
+        while (!started) {
+            std::this_thread::yield();
+        }
+        // the last of the three finds the queue full.
+        server.write("MSG slow 1 1\r\ny\r\nMSG slow 1 1\r\nz\r\n");
+        server.drain();
+    });
+
+    client.start();
+    REQUIRE(runUntil(io, [&] { return connected.load(); }));
+    const auto sub = client.sub("slow", [&](const nats::MessageView& msg) {
+        started = true;
+        while (!release) {
+            std::this_thread::yield();
+        }
+    }, {.pendingMsgs = 1, .autoUnsubscribe = 3});
+    REQUIRE(runUntil(io, [&] { return !errors.empty(); }));
+    release = true;
+    client.shutdown();
+    thread.join();
+
+    REQUIRE(errors == std::vector<NATSClient::Sid>{sub.sid()});
+}